@@ -0,0 +1,393 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "allocator.h"
+
+namespace mem {
+
+namespace {
+
+// in front of every block. malloc aligns to 16, so does the header
+struct Header {
+	uint64_t size;		// requested
+	uint32_t offset;	// from the start of the raw block to the user pointer
+	uint32_t pool;		// size class, or large_block
+};
+
+const size_t header_size = sizeof(Header);
+static_assert(header_size == 16, "header has to keep user pointers 16 byte aligned");
+
+const size_t natural_align = 16;
+const uint32_t large_block = 0xffffffffu;
+// block sizes of the pools, header included
+const size_t pool_block_sizes[] = {32, 64, 128, 256, 512};
+const size_t slab_size = 64 * 1024;
+
+Header* header_of(void* ptr) {
+	return (Header*)((uint8_t*)ptr - header_size);
+}
+
+uint8_t* align_up(uint8_t* ptr, size_t align) {
+	uintptr_t p = uintptr_t(ptr);
+	return (uint8_t*)((p + align - 1) & ~uintptr_t(align - 1));
+}
+
+Counters scratch_counters;
+
+}
+
+// counters
+
+Counters::Counters()
+	: _bytes(0),
+	  _peak_bytes(0),
+	  _alloc_calls(0),
+	  _realloc_calls(0),
+	  _free_calls(0),
+	  _pool_hits(0) {}
+
+void Counters::add_bytes(uint64_t size) {
+	uint64_t bytes = _bytes.fetch_add(size, std::memory_order_relaxed) + size;
+	uint64_t peak = _peak_bytes.load(std::memory_order_relaxed);
+	while (bytes > peak && !_peak_bytes.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {
+	}
+}
+
+void Counters::on_alloc(size_t size, bool pooled) {
+	_alloc_calls.fetch_add(1, std::memory_order_relaxed);
+	if (pooled) {
+		_pool_hits.fetch_add(1, std::memory_order_relaxed);
+	}
+	add_bytes(size);
+}
+
+void Counters::on_free(size_t size) {
+	_free_calls.fetch_add(1, std::memory_order_relaxed);
+	_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+void Counters::on_resize(size_t old_size, size_t new_size) {
+	_realloc_calls.fetch_add(1, std::memory_order_relaxed);
+	if (new_size > old_size) {
+		add_bytes(new_size - old_size);
+	} else {
+		_bytes.fetch_sub(old_size - new_size, std::memory_order_relaxed);
+	}
+}
+
+Stats Counters::snapshot() const {
+	Stats s;
+	s.bytes = _bytes.load(std::memory_order_relaxed);
+	s.peak_bytes = _peak_bytes.load(std::memory_order_relaxed);
+	s.alloc_calls = _alloc_calls.load(std::memory_order_relaxed);
+	s.realloc_calls = _realloc_calls.load(std::memory_order_relaxed);
+	s.free_calls = _free_calls.load(std::memory_order_relaxed);
+	s.pool_hits = _pool_hits.load(std::memory_order_relaxed);
+	return s;
+}
+
+// allocator
+
+Allocator::Allocator() {
+	for (Pool& pool : _pools) {
+		pool.free_list = nullptr;
+	}
+}
+
+Allocator::~Allocator() {
+	for (Pool& pool : _pools) {
+		for (void* slab : pool.slabs) {
+			std::free(slab);
+		}
+	}
+}
+
+void* Allocator::allocate(size_t size, size_t align) {
+	bool pooled;
+	void* ptr = allocate_block(size, align, pooled);
+	if (ptr) {
+		_counters.on_alloc(size, pooled);
+	}
+	return ptr;
+}
+
+void Allocator::release(void* ptr) {
+	_counters.on_free(size_t(header_of(ptr)->size));
+	free_block(ptr);
+}
+
+void* Allocator::allocate_block(size_t size, size_t align, bool& pooled) {
+	align = std::max(align, natural_align);
+
+	if (align == natural_align) {
+		for (uint32_t p = 0; p < pool_count; ++p) {
+			if (size + header_size > pool_block_sizes[p]) {
+				continue;
+			}
+
+			Pool& pool = _pools[p];
+			uint8_t* block;
+			{
+				std::lock_guard<std::mutex> lock(pool.mutex);
+				if (!pool.free_list) {
+					// carve a new slab, blocks linked through their first bytes
+					uint8_t* slab = (uint8_t*)std::malloc(slab_size);
+					if (!slab) {
+						return nullptr;
+					}
+					pool.slabs.push_back(slab);
+					size_t block_size = pool_block_sizes[p];
+					for (size_t offset = 0; offset + block_size <= slab_size; offset += block_size) {
+						*(void**)(slab + offset) = pool.free_list;
+						pool.free_list = slab + offset;
+					}
+				}
+				block = (uint8_t*)pool.free_list;
+				pool.free_list = *(void**)block;
+			}
+
+			Header* h = (Header*)block;
+			h->size = size;
+			h->offset = uint32_t(header_size);
+			h->pool = p;
+			pooled = true;
+			return block + header_size;
+		}
+	}
+
+	// room for the header, and to move the user pointer up to the alignment
+	size_t extra = align == natural_align ? 0 : align;
+	uint8_t* raw = (uint8_t*)std::malloc(size + header_size + extra);
+	if (!raw) {
+		return nullptr;
+	}
+	uint8_t* ptr = align_up(raw + header_size, align);
+	Header* h = header_of(ptr);
+	h->size = size;
+	h->offset = uint32_t(ptr - raw);
+	h->pool = large_block;
+	pooled = false;
+	return ptr;
+}
+
+void Allocator::free_block(void* ptr) {
+	Header* h = header_of(ptr);
+	if (h->pool == large_block) {
+		std::free((uint8_t*)ptr - h->offset);
+		return;
+	}
+
+	Pool& pool = _pools[h->pool];
+	void* block = h;
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	*(void**)block = pool.free_list;
+	pool.free_list = block;
+}
+
+// one realloc for the counters whichever way the block goes, only the bytes change
+void* Allocator::resize(void* ptr, size_t size, size_t align) {
+	Header* h = header_of(ptr);
+	size_t old_size = size_t(h->size);
+
+	// still fits its pool block. Pool blocks are only 16 byte aligned, over-aligned requests move
+	if (h->pool != large_block && align <= natural_align && size + header_size <= pool_block_sizes[h->pool]) {
+		_counters.on_resize(old_size, size);
+		h->size = size;
+		return ptr;
+	}
+
+	// plain malloc block, let the system grow it in place if it can
+	if (h->pool == large_block && h->offset == header_size && align <= natural_align && size + header_size > 512) {
+		uint8_t* raw = (uint8_t*)std::realloc((uint8_t*)ptr - header_size, size + header_size);
+		if (!raw) {
+			return nullptr;
+		}
+		_counters.on_resize(old_size, size);
+		((Header*)raw)->size = size;
+		return raw + header_size;
+	}
+
+	bool pooled;
+	void* moved = allocate_block(size, align, pooled);
+	if (!moved) {
+		return nullptr;
+	}
+	std::memcpy(moved, ptr, std::min(old_size, size));
+	free_block(ptr);
+	_counters.on_resize(old_size, size);
+	return moved;
+}
+
+void* Allocator::realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) {
+	(void)_file;
+	(void)_line;
+	if (_size == 0) {
+		if (_ptr) {
+			release(_ptr);
+		}
+		return nullptr;
+	}
+	if (!_ptr) {
+		return allocate(_size, _align);
+	}
+	return resize(_ptr, _size, _align);
+}
+
+Stats Allocator::stats() const {
+	return _counters.snapshot();
+}
+
+// linear arena
+
+LinearArena::LinearArena(size_t chunk_size, Counters* counters)
+	: _chunk_size(chunk_size),
+	  _chunk(0),
+	  _offset(0),
+	  _used(0),
+	  _last(nullptr),
+	  _last_offset(0),
+	  _counters(counters ? counters : &_own_counters) {}
+
+LinearArena::~LinearArena() {
+	rewind({0, 0, 0});
+	for (Chunk& c : _chunks) {
+		std::free(c.data);
+	}
+}
+
+void* LinearArena::allocate(size_t size, size_t align) {
+	void* ptr = bump(size, align);
+	if (ptr) {
+		_counters->on_alloc(size, false);
+	}
+	return ptr;
+}
+
+void* LinearArena::bump(size_t size, size_t align) {
+	align = std::max(align, natural_align);
+	for (;;) {
+		if (_chunk < _chunks.size()) {
+			Chunk& c = _chunks[_chunk];
+			uint8_t* ptr = align_up(c.data + _offset + header_size, align);
+			if (ptr + size <= c.data + c.size) {
+				header_of(ptr)->size = size;
+				_last = ptr;
+				_last_offset = _offset;
+				_offset = size_t(ptr + size - c.data);
+				_used += size;
+				return ptr;
+			}
+			++_chunk;
+			_offset = 0;
+			continue;
+		}
+
+		// chunks are malloc'd, 16 byte aligned
+		size_t chunk_size = std::max(_chunk_size, size + header_size + align);
+		uint8_t* data = (uint8_t*)std::malloc(chunk_size);
+		if (!data) {
+			return nullptr;
+		}
+		_chunks.push_back({data, chunk_size});
+		_chunk = _chunks.size() - 1;
+		_offset = 0;
+	}
+}
+
+void* LinearArena::realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) {
+	(void)_file;
+	(void)_line;
+	if (!_ptr) {
+		return _size ? allocate(_size, _align) : nullptr;
+	}
+
+	uint8_t* ptr = (uint8_t*)_ptr;
+	size_t old_size = size_t(header_of(ptr)->size);
+	bool last = ptr == _last;
+	if (_size == 0) {
+		_counters->on_free(old_size);
+		_used -= old_size;
+		if (last) {
+			_offset = _last_offset;
+			_last = nullptr;
+		}
+		return nullptr;
+	}
+
+	// the last allocation grows or shrinks in place while its chunk has room, and it is aligned enough
+	if (last && _align <= natural_align && ptr + _size <= _chunks[_chunk].data + _chunks[_chunk].size) {
+		_counters->on_resize(old_size, _size);
+		header_of(ptr)->size = _size;
+		_offset = size_t(ptr + _size - _chunks[_chunk].data);
+		_used = _used - old_size + _size;
+		return ptr;
+	}
+
+	// counted as one realloc, like the in place case
+	void* moved = bump(_size, _align);
+	if (!moved) {
+		return nullptr;
+	}
+	std::memcpy(moved, ptr, std::min(old_size, _size));
+	_counters->on_resize(old_size, _size);
+	_used -= old_size;
+	return moved;
+}
+
+LinearArena::Mark LinearArena::mark() const {
+	return {_chunk, _offset, _used};
+}
+
+void LinearArena::rewind(const Mark& m) {
+	if (_used > m.used) {
+		_counters->on_free(_used - m.used);
+	}
+	_used = m.used;
+	_chunk = m.chunk;
+	_offset = m.offset;
+	_last = nullptr;
+
+	// oversized chunks held one big image, no need to keep them around
+	size_t keep = std::min(_chunks.size(), _offset == 0 ? _chunk : _chunk + 1);
+	auto oversized = [this](const Chunk& c) {
+		if (c.size > _chunk_size) {
+			std::free(c.data);
+			return true;
+		}
+		return false;
+	};
+	_chunks.erase(std::remove_if(_chunks.begin() + keep, _chunks.end(), oversized), _chunks.end());
+}
+
+Stats LinearArena::stats() const {
+	return _counters->snapshot();
+}
+
+// shared instances
+
+Allocator& default_allocator() {
+	static Allocator allocator;
+	return allocator;
+}
+
+LinearArena& scratch() {
+	thread_local LinearArena arena(4 << 20, &scratch_counters);
+	return arena;
+}
+
+Stats scratch_stats() {
+	return scratch_counters.snapshot();
+}
+
+ScratchScope::ScratchScope() : _arena(scratch()), _mark(_arena.mark()) {}
+
+ScratchScope::~ScratchScope() {
+	_arena.rewind(_mark);
+}
+
+bx::AllocatorI* ScratchScope::allocator() {
+	return &_arena;
+}
+
+}
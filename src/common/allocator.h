@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "bx/allocator.h"
+
+namespace mem {
+
+struct Stats {
+	uint64_t bytes;			// live, as requested
+	uint64_t peak_bytes;	// high-water mark of the above
+	uint64_t alloc_calls;
+	uint64_t realloc_calls;
+	uint64_t free_calls;
+	uint64_t pool_hits;		// allocations served by a size-class pool
+};
+
+// thread safe, can be shared by allocators reporting together
+class Counters {
+public:
+	Counters();
+
+	void on_alloc(size_t size, bool pooled);
+	void on_free(size_t size);
+	void on_resize(size_t old_size, size_t new_size);
+
+	Stats snapshot() const;
+
+private:
+	void add_bytes(uint64_t size);
+
+	std::atomic<uint64_t> _bytes;
+	std::atomic<uint64_t> _peak_bytes;
+	std::atomic<uint64_t> _alloc_calls;
+	std::atomic<uint64_t> _realloc_calls;
+	std::atomic<uint64_t> _free_calls;
+	std::atomic<uint64_t> _pool_hits;
+};
+
+// General purpose, thread safe. Small blocks come from size-class pools carved out of 64KB slabs,
+// larger ones from malloc, grown in place by realloc when possible.
+// Slabs are only returned to the system by the destructor
+class Allocator : public bx::AllocatorI {
+public:
+	Allocator();
+	~Allocator();
+
+	void* realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) override;
+
+	Stats stats() const;
+
+private:
+	struct Pool {
+		std::mutex mutex;
+		void* free_list;
+		std::vector<void*> slabs;
+	};
+
+	void* allocate(size_t size, size_t align);
+	void release(void* ptr);
+	void* resize(void* ptr, size_t size, size_t align);
+
+	// the above without the counters
+	void* allocate_block(size_t size, size_t align, bool& pooled);
+	void free_block(void* ptr);
+
+	static const int pool_count = 5;
+	Pool _pools[pool_count];
+	Counters _counters;
+};
+
+// Bump allocator for short lived scratch memory, e.g. intermediate images while decoding.
+// Not thread safe. Frees only give memory back when they undo the last allocation,
+// everything else waits for rewind()
+class LinearArena : public bx::AllocatorI {
+public:
+	struct Mark {
+		size_t chunk;
+		size_t offset;
+		size_t used;
+	};
+
+	// reports into counters if given, its own ones otherwise
+	explicit LinearArena(size_t chunk_size = 4 << 20, Counters* counters = nullptr);
+	~LinearArena();
+
+	void* realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) override;
+
+	Mark mark() const;
+
+	// drops everything allocated since m. Chunks larger than the default size go back to the system
+	void rewind(const Mark& m);
+
+	Stats stats() const;
+
+private:
+	struct Chunk {
+		uint8_t* data;
+		size_t size;
+	};
+
+	void* allocate(size_t size, size_t align);
+
+	// allocate() without the counters
+	void* bump(size_t size, size_t align);
+
+	std::vector<Chunk> _chunks;
+	size_t _chunk_size;
+	size_t _chunk;
+	size_t _offset;
+	size_t _used;
+	// start of the last allocation, for in place frees and growth
+	uint8_t* _last;
+	size_t _last_offset;
+
+	Counters _own_counters;
+	Counters* _counters;
+};
+
+// shared by bgfx, bimg and the loaders
+Allocator& default_allocator();
+
+// the calling thread's scratch arena. Every scratch arena reports into scratch_stats()
+LinearArena& scratch();
+
+Stats scratch_stats();
+
+// rewinds the calling thread's scratch arena when the scope ends
+class ScratchScope {
+public:
+	ScratchScope();
+	~ScratchScope();
+
+	bx::AllocatorI* allocator();
+
+private:
+	LinearArena& _arena;
+	LinearArena::Mark _mark;
+};
+
+}
@@ -1,4 +1,7 @@
 #include "application.hpp"
+#include "allocator.h"
+#include "programs.h"
+#include "texture_stream.h"
 
 #define GLFW_EXPOSE_NATIVE_X11
 #define GLFW_EXPOSE_NATIVE_GLX
@@ -169,7 +172,7 @@ int Application::run( int argc, char** argv, bgfx::RendererType::Enum type, uint
 	init.vendorId = vendorId;
 	init.deviceId = deviceId;
 	init.callback = callback;
-	init.allocator = allocator;
+	init.allocator = allocator ? allocator : &mem::default_allocator();
 	bgfx::init( init );
 	// bgfx::setDebug(BGFX_DEBUG_TEXT | BGFX_DEBUG_STATS);
 
@@ -191,6 +194,10 @@ int Application::run( int argc, char** argv, bgfx::RendererType::Enum type, uint
 		lastTime = time;
 
 		glfwPollEvents();
+		// rebuilt shaders are swapped in between frames
+		io::programs().poll();
+		// and streamed textures get their next few bands
+		io::streamer().update();
 		ImBgfx::events( dt );
 		ImGui::NewFrame();
 		update( dt );
@@ -201,6 +208,8 @@ int Application::run( int argc, char** argv, bgfx::RendererType::Enum type, uint
 
 	// Shutdown application and glfw
 	int ret = shutdown();
+	io::programs().clear();
+	io::streamer().clear();
 	ImBgfx::shutdown();
 	bgfx::shutdown();
 	glfwTerminate();
@@ -10,20 +10,6 @@
 namespace app
 {
 
-// allocator
-class Allocator : public bx::AllocatorI {
-public:
-	void* realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) {
-		if (_size == 0) {
-			free(_ptr);
-			return nullptr;
-		}
-		else {
-			return malloc(_size);
-		}
-	}
-};
-
 // application
 class Application
 {
@@ -54,6 +40,7 @@ public:
 		uint16_t vendorId = BGFX_PCI_ID_NONE,
 		uint16_t deviceId = 0,
 		bgfx::CallbackI* callback = NULL,
+		// mem::default_allocator() if NULL
 		bx::AllocatorI* allocator = NULL
 	);
 
@@ -105,7 +92,6 @@ public:
 
 protected:
 	GLFWwindow* mWindow;
-	Allocator mAllocator;
 private:
 	uint32_t mReset;
 	uint32_t mWidth;
@@ -0,0 +1,361 @@
+// Times the asset loading stages over a tree of textures, on a headless bgfx with the noop renderer.
+// usage: asset_bench [--root <dir>] [--reps <n>] [--warmup <n>] [--json <output.json>]
+//
+// Stages, per file:
+//   read     io::open_asset, every page touched
+//   decode   io::load_image_to_container, the read included
+//   texture  io::load_texture_2d up to a bgfx::frame() that takes the texture in.
+//            Skipped for images with a .ktx next to them, load_texture_2d would load that one
+//   cube     io::load_texture_cube for directories holding the six faces, same frame included
+// Throughput is the size of the files over the time taken. Results are grouped by stage and file extension.
+// Run it from runtime/pbr for the build outputs, the default root being textures
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "bgfx/bgfx.h"
+
+#include "file_io.h"
+
+namespace {
+
+const char* image_extensions[] = {"png", "jpg", "jpeg", "tga", "bmp", "hdr", "exr", "ktx", "dds"};
+
+const char* face_names[6] = {"right", "left", "top", "bottom", "front", "back"};
+
+struct Samples {
+	std::vector<double> ms;
+	uint64_t bytes = 0;
+};
+
+// stage, format
+typedef std::map<std::pair<std::string, std::string>, Samples> Results;
+
+struct CubeDir {
+	std::array<std::string, 6> faces;
+	std::string format;
+	uint64_t bytes;
+};
+
+// keeps the page touching from being optimized out
+volatile uint8_t sink;
+
+typedef std::chrono::steady_clock Clock;
+
+double ms_since(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+std::string extension(const std::string& path) {
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+		return std::string();
+	}
+	std::string ext = path.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return char(tolower(c)); });
+	return ext;
+}
+
+uint64_t file_size(const std::string& path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 ? uint64_t(st.st_size) : 0;
+}
+
+bool exists(const std::string& path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0;
+}
+
+// image files under path, and the directories holding six cube faces
+void collect(const std::string& path, std::vector<std::string>& files, std::vector<CubeDir>& cubes) {
+	DIR* dir = opendir(path.c_str());
+	if (!dir) {
+		std::cout << "Cannot open " << path << std::endl;
+		return;
+	}
+	std::vector<std::string> children;
+	while (dirent* e = readdir(dir)) {
+		std::string child = e->d_name;
+		if (child != "." && child != "..") {
+			children.push_back(path + "/" + child);
+		}
+	}
+	closedir(dir);
+	std::sort(children.begin(), children.end());
+
+	for (const std::string& child : children) {
+		struct stat st;
+		if (stat(child.c_str(), &st) != 0) {
+			continue;
+		}
+		if (S_ISDIR(st.st_mode)) {
+			collect(child, files, cubes);
+			continue;
+		}
+		std::string ext = extension(child);
+		if (std::find(std::begin(image_extensions), std::end(image_extensions), ext) != std::end(image_extensions)) {
+			files.push_back(child);
+		}
+	}
+
+	for (const char* ext : {"jpg", "png"}) {
+		CubeDir cube;
+		cube.format = ext;
+		cube.bytes = 0;
+		bool complete = true;
+		for (int i = 0; i < 6; ++i) {
+			cube.faces[i] = path + "/" + face_names[i] + "." + ext;
+			complete = complete && exists(cube.faces[i]);
+			cube.bytes += file_size(cube.faces[i]);
+		}
+		if (complete) {
+			cubes.push_back(cube);
+			break;
+		}
+	}
+}
+
+// nearest rank, samples sorted
+double percentile(const std::vector<double>& sorted, double p) {
+	size_t rank = size_t(p / 100.0 * double(sorted.size()) + 0.5);
+	return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+}
+
+void bench_file(const std::string& path, bool record, Results& results) {
+	std::string format = extension(path);
+	uint64_t bytes = file_size(path);
+
+	Clock::time_point start = Clock::now();
+	io::Asset asset = io::open_asset(path);
+	if (asset.data) {
+		const uint8_t* data = static_cast<const uint8_t*>(asset.data);
+		uint8_t sum = 0;
+		for (size_t i = 0; i < asset.size; i += 4096) {
+			sum ^= data[i];
+		}
+		sink = sum;
+		double ms = ms_since(start);
+		if (record) {
+			results[{"read", format}].ms.push_back(ms);
+			results[{"read", format}].bytes += bytes;
+		}
+		io::close_asset(asset);
+	}
+
+	start = Clock::now();
+	bimg::ImageContainer* image = io::load_image_to_container(path);
+	if (image) {
+		double ms = ms_since(start);
+		if (record) {
+			results[{"decode", format}].ms.push_back(ms);
+			results[{"decode", format}].bytes += bytes;
+		}
+		bimg::imageFree(image);
+	}
+
+	std::string ktx = path.substr(0, path.size() - format.size()) + "ktx";
+	if (format != "ktx" && exists(ktx)) {
+		return;
+	}
+	start = Clock::now();
+	bgfx::TextureHandle tex = io::load_texture_2d(path);
+	bgfx::frame();
+	if (bgfx::isValid(tex)) {
+		double ms = ms_since(start);
+		if (record) {
+			results[{"texture", format}].ms.push_back(ms);
+			results[{"texture", format}].bytes += bytes;
+		}
+		bgfx::destroy(tex);
+	}
+}
+
+void bench_cube(const CubeDir& cube, bool record, Results& results) {
+	Clock::time_point start = Clock::now();
+	bgfx::TextureHandle tex = io::load_texture_cube(cube.faces);
+	bgfx::frame();
+	if (bgfx::isValid(tex)) {
+		double ms = ms_since(start);
+		if (record) {
+			results[{"cube", cube.format}].ms.push_back(ms);
+			results[{"cube", cube.format}].bytes += cube.bytes;
+		}
+		bgfx::destroy(tex);
+	}
+}
+
+struct Summary {
+	std::string stage;
+	std::string format;
+	size_t samples;
+	uint64_t bytes;
+	double total_ms;
+	double mb_per_s;
+	double min_ms;
+	double p50_ms;
+	double p90_ms;
+	double p99_ms;
+	double max_ms;
+};
+
+std::vector<Summary> summarize(Results& results) {
+	std::vector<Summary> summaries;
+	for (auto& r : results) {
+		std::vector<double>& ms = r.second.ms;
+		std::sort(ms.begin(), ms.end());
+		Summary s;
+		s.stage = r.first.first;
+		s.format = r.first.second;
+		s.samples = ms.size();
+		s.bytes = r.second.bytes;
+		s.total_ms = 0.0;
+		for (double m : ms) {
+			s.total_ms += m;
+		}
+		s.mb_per_s = s.total_ms > 0.0 ? double(s.bytes) / 1048576.0 / (s.total_ms / 1000.0) : 0.0;
+		s.min_ms = ms.front();
+		s.p50_ms = percentile(ms, 50.0);
+		s.p90_ms = percentile(ms, 90.0);
+		s.p99_ms = percentile(ms, 99.0);
+		s.max_ms = ms.back();
+		summaries.push_back(s);
+	}
+	return summaries;
+}
+
+void print(const std::vector<Summary>& summaries) {
+	printf("%-8s %-6s %8s %10s %10s %10s %10s %10s %10s\n",
+			"stage", "format", "samples", "MB", "MB/s", "min ms", "p50 ms", "p90 ms", "p99 ms");
+	for (const Summary& s : summaries) {
+		printf("%-8s %-6s %8zu %10.2f %10.1f %10.3f %10.3f %10.3f %10.3f\n",
+				s.stage.c_str(), s.format.c_str(), s.samples, s.bytes / 1048576.0, s.mb_per_s,
+				s.min_ms, s.p50_ms, s.p90_ms, s.p99_ms);
+	}
+}
+
+// as a JSON string, quotes included
+std::string json_string(const std::string& s) {
+	std::string out = "\"";
+	for (char c : s) {
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (uint8_t(c) < 0x20) {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", unsigned(uint8_t(c)));
+				out += buf;
+			} else {
+				out += c;
+			}
+		}
+	}
+	return out + "\"";
+}
+
+bool write_json(const char* path, const std::string& root, int reps, const std::vector<Summary>& summaries) {
+	std::ofstream out(path);
+	out << "{\n";
+	out << "  \"root\": " << json_string(root) << ",\n";
+	out << "  \"reps\": " << reps << ",\n";
+	out << "  \"results\": [";
+	for (size_t i = 0; i < summaries.size(); ++i) {
+		const Summary& s = summaries[i];
+		out << (i ? "," : "") << "\n    {";
+		out << "\"stage\": " << json_string(s.stage) << ", ";
+		out << "\"format\": " << json_string(s.format) << ", ";
+		out << "\"samples\": " << s.samples << ", ";
+		out << "\"bytes\": " << s.bytes << ", ";
+		out << "\"total_ms\": " << s.total_ms << ", ";
+		out << "\"mb_per_s\": " << s.mb_per_s << ", ";
+		out << "\"min_ms\": " << s.min_ms << ", ";
+		out << "\"p50_ms\": " << s.p50_ms << ", ";
+		out << "\"p90_ms\": " << s.p90_ms << ", ";
+		out << "\"p99_ms\": " << s.p99_ms << ", ";
+		out << "\"max_ms\": " << s.max_ms << "}";
+	}
+	out << "\n  ]\n}\n";
+	if (!out) {
+		std::cout << "Cannot write " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+	std::string root = "textures";
+	int reps = 5;
+	int warmup = 1;
+	const char* json = nullptr;
+	for (int i = 1; i < argc; ++i) {
+		bool has_value = i + 1 < argc;
+		if (has_value && strcmp(argv[i], "--root") == 0) {
+			root = argv[++i];
+		} else if (has_value && strcmp(argv[i], "--reps") == 0) {
+			reps = std::max(atoi(argv[++i]), 1);
+		} else if (has_value && strcmp(argv[i], "--warmup") == 0) {
+			warmup = std::max(atoi(argv[++i]), 0);
+		} else if (has_value && strcmp(argv[i], "--json") == 0) {
+			json = argv[++i];
+		} else {
+			std::cout << "usage: asset_bench [--root <dir>] [--reps <n>] [--warmup <n>] [--json <output.json>]" << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<std::string> files;
+	std::vector<CubeDir> cubes;
+	collect(root, files, cubes);
+	if (files.empty() && cubes.empty()) {
+		std::cout << "No images under " << root << std::endl;
+		return 1;
+	}
+
+	bgfx::Init init;
+	init.type = bgfx::RendererType::Noop;
+	init.resolution.width = 1;
+	init.resolution.height = 1;
+	if (!bgfx::init(init)) {
+		std::cout << "Cannot initialize bgfx" << std::endl;
+		return 1;
+	}
+
+	// warm up passes fill the page cache and the io threads, and are not recorded
+	Results results;
+	for (int rep = 0; rep < warmup + reps; ++rep) {
+		bool record = rep >= warmup;
+		for (const std::string& file : files) {
+			bench_file(file, record, results);
+		}
+		for (const CubeDir& cube : cubes) {
+			bench_cube(cube, record, results);
+		}
+		bgfx::frame();
+	}
+	bgfx::shutdown();
+
+	std::cout << files.size() << " files, " << cubes.size() << " cube maps, " << reps << " reps" << std::endl;
+	std::vector<Summary> summaries = summarize(results);
+	print(summaries);
+	if (json && !write_json(json, root, reps, summaries)) {
+		return 1;
+	}
+	return 0;
+}
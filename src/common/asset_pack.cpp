@@ -0,0 +1,71 @@
+// Builds an asset pack, see pack.h
+// usage: asset_pack <output.pack> <name>=<directory or file>...
+//
+// Every file under a directory goes in as name/<path relative to the directory>.
+// name is what the application asks for, relative to its working directory, e.g.
+//   asset_pack pbr.pack shaders=runtime/pbr/shaders ../common_shaders=runtime/common_shaders
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "pack.h"
+
+namespace {
+
+void collect(const std::string& name,
+				const std::string& path,
+				std::vector<std::pair<std::string, std::string>>& files) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) {
+		std::cout << "Cannot open " << path << std::endl;
+		return;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		files.emplace_back(name, path);
+		return;
+	}
+
+	DIR* dir = opendir(path.c_str());
+	if (!dir) {
+		std::cout << "Cannot open " << path << std::endl;
+		return;
+	}
+	while (dirent* e = readdir(dir)) {
+		std::string child = e->d_name;
+		if (child == "." || child == "..") {
+			continue;
+		}
+		collect(name + "/" + child, path + "/" + child, files);
+	}
+	closedir(dir);
+}
+
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		std::cout << "usage: asset_pack <output.pack> <name>=<directory or file>..." << std::endl;
+		return 1;
+	}
+
+	std::vector<std::pair<std::string, std::string>> files;
+	for (int i = 2; i < argc; ++i) {
+		std::string arg = argv[i];
+		size_t eq = arg.find('=');
+		if (eq == std::string::npos) {
+			std::cout << "Expected <name>=<path>, got " << arg << std::endl;
+			return 1;
+		}
+		collect(arg.substr(0, eq), arg.substr(eq + 1), files);
+	}
+
+	if (!io::write_pack(argv[1], files)) {
+		return 1;
+	}
+	std::cout << files.size() << " files -> " << argv[1] << std::endl;
+	return 0;
+}
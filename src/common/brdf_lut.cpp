@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "brdf_lut.h"
+#include "half.h"
+#include "parallel.h"
+#include "sampling.h"
+
+namespace pcp {
+
+namespace {
+
+// per roughness sample set. GGX half vectors around n = (0, 0, 1), see sampling.h
+struct SampleRow {
+	std::vector<float> cos_t; // h.z
+	std::vector<float> sin_t;
+};
+
+float geometry_schlick_ggx(float n_v, float k) {
+	return n_v / (n_v * (1.0f - k) + k);
+}
+
+// v = (sqrt(1 - n_v^2), 0, n_v). Only the x component of h matters for v dot h,
+// which is sin(phi) * sin(theta) once h is in world space
+void integrate(float n_v,
+				float roughness,
+				const SampleRow& row,
+				const std::vector<float>& sin_phi,
+				float& out_a,
+				float& out_b) {
+	const size_t count = sin_phi.size();
+	const float v_x = std::sqrt(1.0f - n_v * n_v);
+	const float v_z = n_v;
+	// note that we use a different k for IBL
+	const float k = (roughness * roughness) / 2.0f;
+	const float g_v = geometry_schlick_ggx(n_v, k);
+
+	float a = 0.0f;
+	float b = 0.0f;
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 vx = _mm_set1_ps(v_x);
+	const __m128 vz = _mm_set1_ps(v_z);
+	const __m128 kk = _mm_set1_ps(k);
+	const __m128 one_m_k = _mm_set1_ps(1.0f - k);
+	const __m128 gv_over_nv = _mm_set1_ps(g_v / n_v);
+	__m128 acc_a = zero;
+	__m128 acc_b = zero;
+	for (; i + 4 <= count; i += 4) {
+		__m128 ct = _mm_loadu_ps(&row.cos_t[i]);
+		__m128 st = _mm_loadu_ps(&row.sin_t[i]);
+		__m128 sp = _mm_loadu_ps(&sin_phi[i]);
+
+		__m128 v_h = _mm_add_ps(_mm_mul_ps(vx, _mm_mul_ps(sp, st)), _mm_mul_ps(vz, ct));
+		v_h = _mm_max_ps(v_h, zero);
+		// l = 2 * (v.h) * h - v
+		__m128 n_l = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(two, v_h), ct), vz);
+		__m128 mask = _mm_cmpgt_ps(n_l, zero);
+		n_l = _mm_max_ps(n_l, zero);
+
+		__m128 g_l = _mm_div_ps(n_l, _mm_add_ps(_mm_mul_ps(n_l, one_m_k), kk));
+		// G * v.h / (n.h * n.v)
+		__m128 g_vis = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(g_l, gv_over_nv), v_h), ct);
+		g_vis = _mm_and_ps(mask, g_vis);
+
+		__m128 c = _mm_sub_ps(one, v_h);
+		__m128 c2 = _mm_mul_ps(c, c);
+		__m128 fc = _mm_mul_ps(_mm_mul_ps(c2, c2), c);
+
+		acc_a = _mm_add_ps(acc_a, _mm_mul_ps(_mm_sub_ps(one, fc), g_vis));
+		acc_b = _mm_add_ps(acc_b, _mm_mul_ps(fc, g_vis));
+	}
+	float lanes_a[4];
+	float lanes_b[4];
+	_mm_storeu_ps(lanes_a, acc_a);
+	_mm_storeu_ps(lanes_b, acc_b);
+	a = lanes_a[0] + lanes_a[1] + lanes_a[2] + lanes_a[3];
+	b = lanes_b[0] + lanes_b[1] + lanes_b[2] + lanes_b[3];
+#endif
+
+	// leftovers, or everything without SSE2
+	for (; i < count; ++i) {
+		float ct = row.cos_t[i];
+		float v_h = std::max(v_x * sin_phi[i] * row.sin_t[i] + v_z * ct, 0.0f);
+		float n_l = 2.0f * v_h * ct - v_z;
+		if (n_l > 0.0f) {
+			float g = geometry_schlick_ggx(n_l, k) * g_v;
+			float g_vis = (g * v_h) / (ct * n_v);
+			float fc = std::pow(1.0f - v_h, 5.0f);
+			a += (1.0f - fc) * g_vis;
+			b += fc * g_vis;
+		}
+	}
+
+	out_a = a / float(count);
+	out_b = b / float(count);
+}
+
+}
+
+void integrate_brdf_lut(uint16_t* texels, int res, int sample_count) {
+	// hammersley points. The azimuth only depends on the sample index
+	std::vector<float> sin_phi(sample_count);
+	std::vector<float> xi_y(sample_count);
+	for (int i = 0; i < sample_count; ++i) {
+		float xi_x = float(i) / float(sample_count);
+		sin_phi[i] = std::sin(2.0f * float(M_PI) * xi_x);
+		xi_y[i] = van_der_corput(uint32_t(i));
+	}
+
+	par::parallel_for(size_t(res), [&](size_t begin, size_t end, unsigned) {
+		SampleRow row;
+		row.cos_t.resize(sample_count);
+		row.sin_t.resize(sample_count);
+		for (size_t y = begin; y < end; ++y) {
+			float roughness = (float(y) + 0.5f) / float(res);
+			for (int i = 0; i < sample_count; ++i) {
+				float cos_t = ggx_cos_theta(xi_y[i], roughness);
+				row.cos_t[i] = cos_t;
+				row.sin_t[i] = std::sqrt(1.0f - cos_t * cos_t);
+			}
+
+			uint16_t* dst = texels + y * res * 2;
+			for (int x = 0; x < res; ++x) {
+				float n_v = (float(x) + 0.5f) / float(res);
+				float a;
+				float b;
+				integrate(n_v, roughness, row, sin_phi, a, b);
+				dst[x * 2 + 0] = half::from_float(a);
+				dst[x * 2 + 1] = half::from_float(b);
+			}
+		}
+	});
+}
+
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+namespace pcp {
+
+const int brdf_lut_sample_count = 1024;
+
+// Split-sum BRDF lut read by pbr_fs.sc, integrated on the cpu across all cores.
+// res x res RG16F texels, row by row. x: n dot v, y: roughness, both sampled at texel centers,
+// row 0 being roughness ~0. GGX importance sampled with sample_count hammersley points.
+// The one estimator of the lut, for brdf_lut_gen at build time and gen_brdf_lut at run time
+void integrate_brdf_lut(uint16_t* texels, int res, int sample_count = brdf_lut_sample_count);
+
+}
@@ -0,0 +1,52 @@
+// Integrates the split-sum BRDF lut on the cpu and writes it as a RG16F .ktx, see brdf_lut.h
+// usage: brdf_lut_gen <output.ktx> [resolution] [sample count]
+
+#include <cstdlib>
+#include <iostream>
+
+#include "bx/allocator.h"
+#include "bx/file.h"
+#include "bimg/bimg.h"
+
+#include "brdf_lut.h"
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cout << "usage: " << argv[0] << " <output.ktx> [resolution] [sample count]" << std::endl;
+		return 1;
+	}
+	const char* output = argv[1];
+	const int res = argc > 2 ? std::atoi(argv[2]) : 512;
+	const int sample_count = argc > 3 ? std::atoi(argv[3]) : pcp::brdf_lut_sample_count;
+	if (res <= 0 || sample_count <= 0) {
+		std::cout << "resolution and sample count should be positive" << std::endl;
+		return 1;
+	}
+
+	bx::DefaultAllocator allocator;
+	bimg::ImageContainer* image = bimg::imageAlloc(&allocator,
+													bimg::TextureFormat::RG16F,
+													uint16_t(res),
+													uint16_t(res),
+													1,
+													1,
+													false,
+													false);
+
+	pcp::integrate_brdf_lut((uint16_t*)image->m_data, res, sample_count);
+
+	bx::FileWriter writer;
+	bx::Error err;
+	if (bx::open(&writer, output, false, &err)) {
+		bimg::imageWriteKtx(&writer, *image, image->m_data, image->m_size, &err);
+		bx::close(&writer);
+	}
+	bimg::imageFree(image);
+
+	if (!err.isOk()) {
+		std::cout << "Cannot write " << output << ", " << err.getMessage().getPtr() << std::endl;
+		return 1;
+	}
+	std::cout << "brdf lut " << res << "x" << res << ", " << sample_count << " samples -> " << output << std::endl;
+	return 0;
+}
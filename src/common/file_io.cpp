@@ -1,42 +1,117 @@
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <vector>
 #include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "file_io.h"
+#include "allocator.h"
+#include "half.h"
+#include "orm.h"
+#include "pack.h"
+#include "parallel.h"
 
 #include "bx/error.h"
+#include "bx/hash.h"
+#include "bx/math.h"
 
 namespace io {
 
-// allocator
-class Allocator : public bx::AllocatorI {
-public:
-	void* realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) {
-		if (_size == 0) {
-			free(_ptr);
-			return nullptr;
-		}
-		else {
-			return malloc(_size);
-		}
+// read only mapping of a whole file, read front to back once.
+// Returns nullptr for a missing or empty file
+static void* map_file(const char* filename, size_t& size) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return nullptr;
+	}
+	size = size_t(st.st_size);
+	void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping keeps its own reference to the file
+	close(fd);
+	if (data == MAP_FAILED) {
+		return nullptr;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+	madvise(data, size, MADV_WILLNEED);
+	return data;
+}
+
+static void unmap_release_cb(void* _ptr, void* _userData) {
+	munmap(_ptr, size_t(uintptr_t(_userData)));
+}
+
+static AssetPack& mounted_pack() {
+	static AssetPack pack;
+	return pack;
+}
+
+bool mount_pack(const char* path) {
+	return mounted_pack().open(path);
+}
+
+void unmount_pack() {
+	mounted_pack().close();
+}
+
+Asset open_asset(const std::string& name, bool from_pack) {
+	Asset a;
+	a.size = 0;
+	a.mapped = false;
+	a.data = from_pack ? mounted_pack().find(name, a.size) : nullptr;
+	if (!a.data) {
+		a.data = map_file(name.c_str(), a.size);
+		a.mapped = a.data != nullptr;
 	}
-};
+	return a;
+}
+
+void close_asset(const Asset& a) {
+	if (a.mapped) {
+		munmap(const_cast<void*>(a.data), a.size);
+	}
+}
+
+static bool asset_exists(const std::string& name) {
+	size_t size;
+	struct stat st;
+	return mounted_pack().find(name, size) || stat(name.c_str(), &st) == 0;
+}
+
+const bgfx::Memory* load_memory(const char* filename, bool from_pack) {
+	Asset a = open_asset(filename, from_pack);
+	if (!a.data) {
+		std::cout << "Cannot open file " << filename << std::endl;
+		return nullptr;
+	}
+	if (!a.mapped) {
+		// the pack outlives bgfx's use of it
+		return bgfx::makeRef(a.data, uint32_t(a.size));
+	}
+	// no copy, bgfx unmaps the file once done with it
+	return bgfx::makeRef(a.data, uint32_t(a.size), unmap_release_cb, (void*)uintptr_t(a.size));
+}
 
-const bgfx::Memory* load_memory(const char* filename) {
-	std::ifstream file(filename, std::ios::binary | std::ios::ate);
-    if (!file.is_open()) {
-        std::cout << "Cannot open file " << filename << std::endl;
-    }
-	std::streamsize size = file.tellg();
-	file.seekg(0, std::ios::beg);
-	const bgfx::Memory* mem = bgfx::alloc(uint32_t(size + 1));
-	if (file.read((char*)mem->data, size)) {
-		mem->data[mem->size - 1] = '\0';
-		return mem;
+uint32_t hash_assets(const std::vector<std::string>& names) {
+	bx::HashMurmur2A hash;
+	hash.begin();
+	for (const std::string& name : names) {
+		Asset a = open_asset(name);
+		if (!a.data) {
+			std::cout << "Cannot open file " << name << " for hashing" << std::endl;
+			continue;
+		}
+		hash.add(a.data, int(a.size));
+		close_asset(a);
 	}
-	return nullptr;
+	return hash.end();
 }
 
 bgfx::ShaderHandle load_shader(const char* shader) {
@@ -56,27 +131,16 @@ void image_release_cb(void* _ptr, void* _userData) {
 }
 
 bimg::ImageContainer* load_image_to_container(const std::string& name) {
-		std::ifstream ifs(name, std::ios::binary);
-	if (!ifs.is_open()) {
+	Asset a = open_asset(name);
+	if (!a.data) {
 		std::cout << "Cannot open texture file " << name << std::endl;
 		return nullptr;
 	}
 
-	ifs.seekg(0, ifs.end);
-	size_t size = static_cast<size_t>(ifs.tellg());
-	if (size == 0) {
-		std::cout << "Texture file " << name << " empty" << std::endl;
-		return nullptr;
-	}
-
-	std::vector<char> buf(size);
-	ifs.seekg(0, ifs.beg);
-	ifs.read(buf.data(), static_cast<std::streamsize>(size));
-	ifs.close();
-
-	bx::AllocatorI* allocator = new Allocator;
+	// decoded straight from the mapping
 	bx::Error err;
-	bimg::ImageContainer* container = bimg::imageParse(allocator, buf.data(), (uint32_t)buf.size(), bimg::TextureFormat::Count, &err);
+	bimg::ImageContainer* container = bimg::imageParse(&mem::default_allocator(), a.data, (uint32_t)a.size, bimg::TextureFormat::Count, &err);
+	close_asset(a);
 
 	if (!container) {
 		std::cout << "Texture file " << name << ", parse error ";
@@ -87,27 +151,218 @@ bimg::ImageContainer* load_image_to_container(const std::string& name) {
 	return container;
 }
 
-bgfx::TextureHandle load_texture_2d(const std::string& name) {
-	bimg::ImageContainer* c = load_image_to_container(name);
+// shared by every async load. Decoding is cpu bound, one thread per core
+static par::ThreadPool& io_pool() {
+	static par::ThreadPool pool;
+	return pool;
+}
+
+std::future<bimg::ImageContainer*> load_image_async(const std::string& name) {
+	return io_pool().submit([name]() { return load_image_to_container(name); });
+}
+
+// decoded image replaced by its mip chain. Null stays null
+static bimg::ImageContainer* with_mips(bimg::ImageContainer* c, MipFilter filter) {
+	if (!c || c->m_numMips > 1) {
+		return c;
+	}
+	bimg::ImageContainer* chain = build_mip_chain(&mem::default_allocator(), *c, filter);
+	if (!chain) {
+		std::cout << "Cannot build the mip chain of a " << c->m_width << "x" << c->m_height << " image" << std::endl;
+	}
+	bimg::imageFree(c);
+	return chain;
+}
+
+// name with its extension swapped for .ktx, if the build made one. Empty otherwise
+static std::string compressed_variant(const std::string& name) {
+	size_t dot = name.find_last_of('.');
+	if (dot == std::string::npos) {
+		return std::string();
+	}
+	std::string ktx = name.substr(0, dot) + ".ktx";
+	return asset_exists(ktx) ? ktx : std::string();
+}
+
+static bool format_supported(bimg::TextureFormat::Enum format) {
+	return (bgfx::getCaps()->formats[format] & BGFX_CAPS_FORMAT_TEXTURE_2D) != 0;
+}
+
+std::future<bimg::ImageContainer*> load_image_async(const std::string& name, MipFilter filter) {
+	return io_pool().submit([name, filter]() {
+		std::string ktx = compressed_variant(name);
+		if (!ktx.empty()) {
+			// already block compressed with mips, parsed only
+			bimg::ImageContainer* c = load_image_to_container(ktx);
+			if (c && format_supported(c->m_format)) {
+				return c;
+			}
+			std::cout << "Cannot use " << ktx << ", loading " << name << " instead" << std::endl;
+			if (c) {
+				bimg::imageFree(c);
+			}
+		}
+		return with_mips(load_image_to_container(name), filter);
+	});
+}
+
+bgfx::TextureHandle load_texture_2d(const std::string& name, MipFilter filter) {
+	std::string ktx = compressed_variant(name);
+	if (!ktx.empty()) {
+		bgfx::TextureInfo info;
+		bgfx::TextureHandle handle = load_texture(ktx, 0, &info);
+		if (bgfx::isValid(handle) && format_supported(bimg::TextureFormat::Enum(info.format))) {
+			return handle;
+		}
+		std::cout << "Cannot use " << ktx << ", loading " << name << " instead" << std::endl;
+		if (bgfx::isValid(handle)) {
+			bgfx::destroy(handle);
+		}
+	}
+	return create_texture_2d(load_image_to_container(name), filter);
+}
+
+bgfx::TextureHandle create_texture_2d(bimg::ImageContainer* c, MipFilter filter) {
+	c = with_mips(c, filter);
 	if (!c) {
 		return BGFX_INVALID_HANDLE;
 	}
 
+	assert(c->m_numLayers == 1);
 	const bgfx::Memory* mem = bgfx::makeRef(c->m_data, c->m_size, image_release_cb, c);
-	assert(c->m_numMips == 1);
-	bgfx::TextureHandle handle = bgfx::createTexture2D(uint16_t(c->m_width),
-														uint16_t(c->m_height),
-														false,
-														c->m_numLayers,
-														bgfx::TextureFormat::Enum(c->m_format),
-														0);
-	bgfx::updateTexture2D(handle, c->m_numLayers, 0, 0, 0, c->m_width, c->m_height, mem);
-	return handle;
+	return bgfx::createTexture2D(uint16_t(c->m_width),
+								uint16_t(c->m_height),
+								true,
+								1,
+								bgfx::TextureFormat::Enum(c->m_format),
+								0,
+								mem);
+}
+
+// dir/name.png, or .jpg. Empty if neither exists
+static std::string find_map(const std::string& dir, const char* name) {
+	for (const char* ext : {".png", ".jpg"}) {
+		std::string path = dir + "/" + name + ext;
+		if (asset_exists(path)) {
+			return path;
+		}
+	}
+	return std::string();
+}
+
+// a null image right away for a map the set does not have
+static std::future<bimg::ImageContainer*> load_map_async(const std::string& path) {
+	if (path.empty()) {
+		std::promise<bimg::ImageContainer*> none;
+		none.set_value(nullptr);
+		return none.get_future();
+	}
+	return load_image_async(path);
+}
+
+static std::future<bimg::ImageContainer*> load_map_async(const std::string& path, MipFilter filter) {
+	if (path.empty()) {
+		std::promise<bimg::ImageContainer*> none;
+		none.set_value(nullptr);
+		return none.get_future();
+	}
+	return load_image_async(path, filter);
+}
+
+// orm.ktx from the build, or the single channel maps packed and mipmapped here
+static bimg::ImageContainer* load_orm(const std::string& dir) {
+	std::string ktx = dir + "/orm.ktx";
+	if (asset_exists(ktx)) {
+		bimg::ImageContainer* c = load_image_to_container(ktx);
+		if (c && format_supported(c->m_format)) {
+			return c;
+		}
+		std::cout << "Cannot use " << ktx << ", packing the maps of " << dir << " instead" << std::endl;
+		if (c) {
+			bimg::imageFree(c);
+		}
+	}
+
+	const char* names[4] = {"ao", "roughness", "metallic", "height"};
+	std::future<bimg::ImageContainer*> loads[4];
+	for (int i = 0; i < 4; ++i) {
+		loads[i] = load_map_async(find_map(dir, names[i]));
+	}
+	bimg::ImageContainer* maps[4];
+	for (int i = 0; i < 4; ++i) {
+		maps[i] = loads[i].get();
+	}
+	bimg::ImageContainer* packed = pack_orm(&mem::default_allocator(), maps[0], maps[1], maps[2], maps[3]);
+	for (bimg::ImageContainer* map : maps) {
+		if (map) {
+			bimg::imageFree(map);
+		}
+	}
+	return with_mips(packed, MipFilter::Linear);
+}
+
+std::future<MaterialImages> load_material_async(const std::string& dir) {
+	// waits on the io pool, so it cannot be one of its tasks
+	return std::async(std::launch::async, [dir]() {
+		std::future<bimg::ImageContainer*> albedo = load_map_async(find_map(dir, "albedo"), MipFilter::Srgb);
+		std::future<bimg::ImageContainer*> normal = load_map_async(find_map(dir, "normal"), MipFilter::Normal);
+		MaterialImages images;
+		images.orm = load_orm(dir);
+		images.albedo = albedo.get();
+		images.normal = normal.get();
+		return images;
+	});
+}
+
+Material create_material(const MaterialImages& images) {
+	Material material;
+	material.albedo = create_texture_2d(images.albedo, MipFilter::Srgb);
+	material.normal = create_texture_2d(images.normal, MipFilter::Normal);
+	material.orm = create_texture_2d(images.orm, MipFilter::Linear);
+	return material;
+}
+
+Material load_material(const std::string& dir) {
+	return create_material(load_material_async(dir).get());
+}
+
+MaterialStreams stream_material(const std::string& dir) {
+	MaterialStreams streams;
+	// white, a normal straight up, and ao = 1, roughness = 1, metallic = 0, height = 0
+	streams.albedo = streamer().add_2d(load_map_async(find_map(dir, "albedo"), MipFilter::Srgb), 0xffffffff);
+	streams.normal = streamer().add_2d(load_map_async(find_map(dir, "normal"), MipFilter::Normal), 0x8080ffff);
+	// waits on the io pool, so it cannot be one of its tasks
+	streams.orm = streamer().add_2d(std::async(std::launch::async, load_orm, dir), 0xffff0000);
+	return streams;
 }
 
 // for 6 individual images.
 // names order: +x, -x, +y, -y, +z, -z
 bgfx::TextureHandle load_texture_cube(const std::array<std::string, 6>& names) {
+	std::array<std::future<bimg::ImageContainer*>, 6> loads;
+	for (int i = 0; i < 6; ++i) {
+		loads[i] = load_image_async(names[i]);
+	}
+
+	std::array<bimg::ImageContainer*, 6> faces;
+	bool ok = true;
+	for (int i = 0; i < 6; ++i) {
+		faces[i] = loads[i].get();
+		ok = ok && faces[i];
+	}
+	if (!ok) {
+		for (bimg::ImageContainer* face : faces) {
+			if (face) {
+				bimg::imageFree(face);
+			}
+		}
+		return BGFX_INVALID_HANDLE;
+	}
+
+	return create_texture_cube(faces);
+}
+
+bgfx::TextureHandle create_texture_cube(const std::array<bimg::ImageContainer*, 6>& faces) {
 	uint8_t side_order[6] = {
 		BGFX_CUBE_MAP_POSITIVE_X, BGFX_CUBE_MAP_NEGATIVE_X,
 		BGFX_CUBE_MAP_POSITIVE_Y, BGFX_CUBE_MAP_NEGATIVE_Y,
@@ -116,23 +371,33 @@ bgfx::TextureHandle load_texture_cube(const std::array<std::string, 6>& names) {
 
 	bgfx::TextureHandle handle = BGFX_INVALID_HANDLE;
 	for (int i = 0; i < 6; ++i) {
-		bimg::ImageContainer* c = load_image_to_container(names[i]);
+		assert(faces[i]->m_numMips == 1);
+		// the full mip chain lets the prefilter pass read pre-averaged texels
+		bimg::ImageContainer* c = build_mip_chain(&mem::default_allocator(), *faces[i], MipFilter::Srgb);
+		bimg::imageFree(faces[i]);
 		if (!c) {
-			return BGFX_INVALID_HANDLE;
+			std::cout << "Cannot convert cube map face " << i << " to RGBA8" << std::endl;
+			continue;
 		}
 
-		assert(c->m_numMips == 1);
 		if (!bgfx::isValid(handle)) {
 			// The first side
 			handle = bgfx::createTextureCube(uint16_t(c->m_width),
-											false,
-											c->m_numLayers,
-											bgfx::TextureFormat::Enum(c->m_format),
+											true,
+											1,
+											bgfx::TextureFormat::RGBA8,
 											BGFX_SAMPLER_UVW_CLAMP);
 		}
 
-		const bgfx::Memory* mem = bgfx::makeRef(c->m_data, c->m_size, image_release_cb, c);
-		bgfx::updateTextureCube(handle, c->m_numLayers, side_order[i], 0, 0, 0, c->m_width, c->m_height, mem);
+		for (uint8_t lod = 0; lod < c->m_numMips; ++lod) {
+			bimg::ImageMip mip;
+			bimg::imageGetRawData(*c, 0, lod, c->m_data, c->m_size, mip);
+			// the container goes with the last mip
+			const bgfx::Memory* mem = lod + 1 == c->m_numMips
+				? bgfx::makeRef(mip.m_data, mip.m_size, image_release_cb, c)
+				: bgfx::makeRef(mip.m_data, mip.m_size);
+			bgfx::updateTextureCube(handle, 0, side_order[i], lod, 0, 0, uint16_t(mip.m_width), uint16_t(mip.m_height), mem);
+		}
 	}
 
 	return handle;
@@ -140,20 +405,79 @@ bgfx::TextureHandle load_texture_cube(const std::array<std::string, 6>& names) {
 
 // for a single equirectangular map. ktx format only
 bgfx::TextureHandle load_texture_cube_immutable_ktx(const std::string& name) {
+	// bgfx parses the container from the mapping, nothing is decoded or copied on the way
+	bgfx::TextureInfo info;
+	bgfx::TextureHandle handle = load_texture(name, BGFX_SAMPLER_UVW_CLAMP, &info);
+	assert(!bgfx::isValid(handle) || info.cubeMap); // .png will fail here
+	return handle;
+}
+
+bimg::ImageContainer* load_image_equirect(const std::string& name) {
 	bimg::ImageContainer* c = load_image_to_container(name);
-	if (!c) {
+	if (!c || c->m_format == bimg::TextureFormat::RGBA16F) {
+		return c;
+	}
+
+	// the RGBA32F intermediate only lives until the halves are out
+	mem::ScratchScope scratch;
+	if (c->m_format != bimg::TextureFormat::RGBA32F) {
+		bimg::ImageContainer* rgba32f = bimg::imageConvert(scratch.allocator(), bimg::TextureFormat::RGBA32F, *c, false);
+		bimg::imageFree(c);
+		if (!rgba32f) {
+			std::cout << "Cannot convert " << name << " to RGBA32F" << std::endl;
+			return nullptr;
+		}
+		c = rgba32f;
+	}
+
+	bimg::ImageContainer* half = bimg::imageAlloc(&mem::default_allocator(),
+													bimg::TextureFormat::RGBA16F,
+													uint16_t(c->m_width),
+													uint16_t(c->m_height),
+													1,
+													1,
+													false,
+													false);
+	const float* src = (const float*)c->m_data;
+	uint16_t* dst = (uint16_t*)half->m_data;
+	const size_t row = size_t(c->m_width) * 4;
+	par::parallel_for(c->m_height, [&](size_t begin, size_t end, unsigned) {
+		half::from_float(dst + begin * row, src + begin * row, (end - begin) * row);
+	});
+	bimg::imageFree(c);
+	return half;
+}
+
+std::future<bimg::ImageContainer*> load_image_equirect_async(const std::string& name) {
+	return io_pool().submit([name]() { return load_image_equirect(name); });
+}
+
+bgfx::TextureHandle create_texture_equirect(bimg::ImageContainer* image) {
+	assert(image->m_format == bimg::TextureFormat::RGBA16F);
+	const bgfx::Memory* mem = bgfx::makeRef(image->m_data, image->m_size, image_release_cb, image);
+	// wraps around the longitudes only
+	return bgfx::createTexture2D(uint16_t(image->m_width),
+								uint16_t(image->m_height),
+								false,
+								1,
+								bgfx::TextureFormat::RGBA16F,
+								BGFX_SAMPLER_V_CLAMP,
+								mem);
+}
+
+bgfx::TextureHandle load_texture_equirect(const std::string& name) {
+	bimg::ImageContainer* image = load_image_equirect(name);
+	if (!image) {
 		return BGFX_INVALID_HANDLE;
 	}
-	assert(c->m_numMips == 1);
-	assert(c->m_cubeMap); // this will in fact check if image is in .ktx format. .png will fail here
+	return create_texture_equirect(image);
+}
 
-	const bgfx::Memory* mem = bgfx::makeRef(c->m_data, c->m_size, image_release_cb, c);
-	bgfx::TextureHandle handle = bgfx::createTextureCube(uint16_t(c->m_width),
-														false,
-														c->m_numLayers,
-														bgfx::TextureFormat::Enum(c->m_format),
-														BGFX_SAMPLER_UVW_CLAMP,
-														mem);
-	return handle;
+bgfx::TextureHandle load_texture(const std::string& name, uint64_t flags, bgfx::TextureInfo* info) {
+	const bgfx::Memory* mem = load_memory(name.c_str());
+	if (!mem) {
+		return BGFX_INVALID_HANDLE;
+	}
+	return bgfx::createTexture(mem, flags, 0, info);
 }
 }
\ No newline at end of file
@@ -1,32 +1,128 @@
 #pragma once
 
 #include <array>
+#include <future>
 #include <string>
+#include <vector>
 
 #include "bgfx/bgfx.h"
 
 #include "bimg/bimg.h"
 #include "bimg/decode.h"
 
+#include "mip_chain.h"
+#include "programs.h"
+#include "texture_stream.h"
+
 namespace io {
 
-const bgfx::Memory* load_memory(const char* filename);
+// Every loader below looks its file up in the mounted pack first, see pack.h and the asset_pack tool.
+// Loose files are the fallback. The pack stays mapped until unmount_pack(),
+// which has to wait until bgfx is done with everything created from it
+bool mount_pack(const char* path);
+
+void unmount_pack();
+
+// a view into the mounted pack, or a read only mapping of its own for a loose file.
+// data is null if the file is missing. close_asset unmaps the loose file
+struct Asset {
+	const void* data;
+	size_t size;
+	bool mapped;
+};
+
+Asset open_asset(const std::string& name, bool from_pack = true);
+
+void close_asset(const Asset& a);
+
+// the file mapped read only, or its view in the pack, handed to bgfx without a copy.
+// A loose file is unmapped once bgfx is done with it
+const bgfx::Memory* load_memory(const char* filename, bool from_pack = true);
+
+// content hash of the files, looked up like the loaders do. Missing ones are skipped
+uint32_t hash_assets(const std::vector<std::string>& names);
 
 bgfx::ShaderHandle load_shader(const char* shader);
 
+// a new program, owned by the caller. See io::programs() for shared, hot reloaded ones
 bgfx::ProgramHandle load_program(const char* vs_name, const char* fs_name);
 
 void image_release_cb(void* _ptr, void* _userData);
 
 bimg::ImageContainer* load_image_to_container(const std::string& name);
 
-bgfx::TextureHandle load_texture_2d(const std::string& name);
+// Read and decoded on a pool of io threads, in parallel with other loads.
+// Textures are created from the result on the API thread, see create_texture_2d/create_texture_cube
+std::future<bimg::ImageContainer*> load_image_async(const std::string& name);
+
+// For material maps. The block compressed .ktx next to name is taken as is if there is one
+// and the gpu samples its format. Otherwise name is decoded and gets its mip chain built on the io thread too
+std::future<bimg::ImageContainer*> load_image_async(const std::string& name, MipFilter filter);
+
+// same rules as above. The .ktx goes straight from the file mapping to bgfx
+bgfx::TextureHandle load_texture_2d(const std::string& name, MipFilter filter = MipFilter::Linear);
+
+// from an already decoded image. Takes ownership of it. Invalid handle for a null image.
+// The mip chain is built here unless the image has one already
+bgfx::TextureHandle create_texture_2d(bimg::ImageContainer* image, MipFilter filter = MipFilter::Linear);
+
+// a material set directory. ao, roughness, metallic and height share orm, channels as in orm.h
+struct Material {
+	bgfx::TextureHandle albedo;
+	bgfx::TextureHandle normal;
+	bgfx::TextureHandle orm;
+};
+
+struct MaterialImages {
+	bimg::ImageContainer* albedo;
+	bimg::ImageContainer* normal;
+	bimg::ImageContainer* orm;
+};
 
-// for 6 individual images.
+// Every map is read and decoded on the io threads. orm.ktx from the build is taken if there is one,
+// the single channel maps are packed then and there otherwise. Missing maps are left null
+std::future<MaterialImages> load_material_async(const std::string& dir);
+
+// takes ownership of the images. Invalid handles for missing maps
+Material create_material(const MaterialImages& images);
+
+Material load_material(const std::string& dir);
+
+// same maps, through io::streamer(). Shows flat placeholders right away, see TextureStreamer
+struct MaterialStreams {
+	StreamId albedo;
+	StreamId normal;
+	StreamId orm;
+};
+
+MaterialStreams stream_material(const std::string& dir);
+
+// for 6 individual images, with a full mip chain. Faces are decoded in parallel.
 // names order: +x, -x, +y, -y, +z, -z
 bgfx::TextureHandle load_texture_cube(const std::array<std::string, 6>& names);
 
+// same as above, from already decoded faces. Takes ownership of them.
+// Faces are converted to RGBA8 and get a full mip chain
+bgfx::TextureHandle create_texture_cube(const std::array<bimg::ImageContainer*, 6>& faces);
+
 // for a single equirectangular map. ktx format only
 bgfx::TextureHandle load_texture_cube_immutable_ktx(const std::string& name);
 
+// equirectangular .hdr/.exr, or anything else bimg decodes, as a RGBA16F image.
+// Row 0 looks straight up. Safe to call off the main thread
+bimg::ImageContainer* load_image_equirect(const std::string& name);
+
+std::future<bimg::ImageContainer*> load_image_equirect_async(const std::string& name);
+
+// 2D RGBA16F texture from the above. Takes ownership of image
+bgfx::TextureHandle create_texture_equirect(bimg::ImageContainer* image);
+
+bgfx::TextureHandle load_texture_equirect(const std::string& name);
+
+// .ktx/.dds as is, mips and cube faces included. bgfx parses the container itself,
+// straight from the file mapping
+bgfx::TextureHandle load_texture(const std::string& name,
+								uint64_t flags = BGFX_SAMPLER_UVW_CLAMP,
+								bgfx::TextureInfo* info = nullptr);
+
 }
\ No newline at end of file
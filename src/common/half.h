@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// float to IEEE half, round to nearest even like the gpu and F16C. Nan stays quiet, out of range goes to infinity.
+// F. Giesen's float_to_half_fast3_rtne. No bx, the procedural shapes use it too
+namespace half {
+
+inline uint16_t from_float(float value) {
+	const uint32_t f32_infty = 255u << 23;
+	const uint32_t f16_max = (127u + 16u) << 23;
+	const uint32_t denorm_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+	uint32_t u;
+	memcpy(&u, &value, sizeof(u));
+	uint32_t sign = u & 0x80000000u;
+	u ^= sign;
+
+	uint32_t o;
+	if (u >= f16_max) {
+		o = u > f32_infty ? 0x7e00 : 0x7c00;
+	} else if (u < (113u << 23)) {
+		// subnormal or zero, the fpu does the rounding
+		float f;
+		float magic;
+		memcpy(&f, &u, sizeof(f));
+		memcpy(&magic, &denorm_magic, sizeof(magic));
+		f += magic;
+		memcpy(&o, &f, sizeof(o));
+		o -= denorm_magic;
+	} else {
+		uint32_t mant_odd = (u >> 13) & 1;
+		u += (uint32_t(15 - 127) << 23) + 0xfffu;
+		u += mant_odd;
+		o = u >> 13;
+	}
+	return uint16_t(o | (sign >> 16));
+}
+
+#if defined(__SSE2__) && !defined(__F16C__)
+// from_float on 4 floats, the halves in the low 16 bits of each lane.
+// Both the normal and subnormal paths computed then selected
+inline __m128i from_float4(__m128 f) {
+	const __m128i sign_mask = _mm_set1_epi32(int(0x80000000u));
+	const __m128i f32_infty = _mm_set1_epi32(255 << 23);
+	const __m128i f16_max = _mm_set1_epi32((127 + 16) << 23);
+	const __m128i denorm_magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+	const __m128i min_normal = _mm_set1_epi32(113 << 23);
+	const __m128i rebias = _mm_set1_epi32(int((uint32_t(15 - 127) << 23) + 0xfffu));
+	const __m128i one = _mm_set1_epi32(1);
+
+	__m128i u = _mm_castps_si128(f);
+	__m128i sign = _mm_and_si128(u, sign_mask);
+	u = _mm_xor_si128(u, sign);
+
+	// inf or nan, nan stays quiet
+	__m128i is_nan = _mm_cmpgt_epi32(u, f32_infty);
+	__m128i o_big = _mm_or_si128(_mm_and_si128(is_nan, _mm_set1_epi32(0x7e00)),
+								_mm_andnot_si128(is_nan, _mm_set1_epi32(0x7c00)));
+	// subnormal or zero, the fpu does the rounding
+	__m128 den = _mm_add_ps(_mm_castsi128_ps(u), _mm_castsi128_ps(denorm_magic));
+	__m128i o_den = _mm_sub_epi32(_mm_castps_si128(den), denorm_magic);
+	// normal
+	__m128i mant_odd = _mm_and_si128(_mm_srli_epi32(u, 13), one);
+	__m128i o_norm = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(u, rebias), mant_odd), 13);
+
+	__m128i is_den = _mm_cmplt_epi32(u, min_normal);
+	__m128i is_big = _mm_cmpgt_epi32(u, _mm_sub_epi32(f16_max, one));
+	__m128i o = _mm_or_si128(_mm_and_si128(is_den, o_den), _mm_andnot_si128(is_den, o_norm));
+	o = _mm_or_si128(_mm_and_si128(is_big, o_big), _mm_andnot_si128(is_big, o));
+	o = _mm_or_si128(o, _mm_srli_epi32(sign, 16));
+	// sign extend so that the saturating pack keeps the bits
+	return _mm_srai_epi32(_mm_slli_epi32(o, 16), 16);
+}
+#endif
+
+// 8 at a time with F16C or SSE2, one by one for the rest. Same bits either way, but F16C keeps nan payloads
+inline void from_float(uint16_t* dst, const float* src, size_t count) {
+	size_t i = 0;
+#if defined(__F16C__)
+	for (; i + 8 <= count; i += 8) {
+		__m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i*)(dst + i), h);
+	}
+#elif defined(__SSE2__)
+	for (; i + 8 <= count; i += 8) {
+		__m128i lo = from_float4(_mm_loadu_ps(src + i));
+		__m128i hi = from_float4(_mm_loadu_ps(src + i + 4));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(lo, hi));
+	}
+#endif
+	for (; i < count; ++i) {
+		dst[i] = from_float(src[i]);
+	}
+}
+
+}
@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include <glm/glm.hpp>
+
+#include "mesh_optimize.h"
+
+namespace mesh {
+
+namespace {
+
+// Forsyth's scoring constants
+const int score_cache_size = 32;
+const float last_triangle_score = 0.75f;
+const float cache_decay_power = 1.5f;
+const float valence_boost_scale = 2.0f;
+const float valence_boost_power = 0.5f;
+
+const uint32_t no_triangle = UINT32_MAX;
+
+float vertex_score(int cache_pos, uint32_t remaining) {
+	if (remaining == 0) {
+		// nothing left to draw with it
+		return -1.0f;
+	}
+	float score = 0.0f;
+	if (cache_pos >= 0) {
+		// the last triangle's vertices get a fixed score, or the next triangle would be picked right next to it every time
+		score = cache_pos < 3
+			? last_triangle_score
+			: std::pow(1.0f - float(cache_pos - 3) / float(score_cache_size - 3), cache_decay_power);
+	}
+	// vertices with few triangles left go first, they get out of the way for good
+	return score + valence_boost_scale * std::pow(float(remaining), -valence_boost_power);
+}
+
+// misses of each triangle, in order. A vertex is a hit while fewer than cache_size misses came after its own.
+// Clock only moves on, cold() empties the cache at once
+class FifoCache {
+public:
+	FifoCache(size_t vertex_count, uint32_t cache_size)
+		: _stamps(vertex_count, 0),
+		  _time(cache_size + 1),
+		  _cache_size(cache_size) {}
+
+	template <typename Index>
+	uint32_t triangle(const Index* tri) {
+		uint32_t misses = 0;
+		for (int k = 0; k < 3; ++k) {
+			if (_time - _stamps[tri[k]] > _cache_size) {
+				_stamps[tri[k]] = _time++;
+				++misses;
+			}
+		}
+		return misses;
+	}
+
+	void cold() {
+		_time += _cache_size + 1;
+	}
+
+private:
+	std::vector<uint32_t> _stamps;
+	uint32_t _time;
+	uint32_t _cache_size;
+};
+
+glm::vec3 position(const float* positions, size_t stride, size_t vertex) {
+	const float* p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + vertex * stride);
+	return glm::vec3(p[0], p[1], p[2]);
+}
+
+}
+
+template <typename Index>
+CacheStats analyze_vertex_cache(const Index* indices, size_t index_count, size_t vertex_count, uint32_t cache_size) {
+	FifoCache cache(vertex_count, cache_size);
+	uint32_t misses = 0;
+	for (size_t i = 0; i + 2 < index_count; i += 3) {
+		misses += cache.triangle(indices + i);
+	}
+	CacheStats stats;
+	stats.acmr = index_count >= 3 ? float(misses) / float(index_count / 3) : 0.0f;
+	stats.atvr = vertex_count > 0 ? float(misses) / float(vertex_count) : 0.0f;
+	return stats;
+}
+
+template <typename Index>
+void optimize_vertex_cache(Index* indices, size_t index_count, size_t vertex_count) {
+	size_t tri_count = index_count / 3;
+	if (tri_count == 0) {
+		return;
+	}
+
+	// triangles of every vertex. The first remaining[v] of them are not drawn yet
+	std::vector<uint32_t> offsets(vertex_count + 1, 0);
+	for (size_t i = 0; i < tri_count * 3; ++i) {
+		++offsets[indices[i] + 1];
+	}
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+	std::vector<uint32_t> remaining(vertex_count, 0);
+	std::vector<uint32_t> adjacency(tri_count * 3);
+	for (size_t i = 0; i < tri_count * 3; ++i) {
+		Index v = indices[i];
+		adjacency[offsets[v] + remaining[v]++] = uint32_t(i / 3);
+	}
+
+	std::vector<int> cache_pos(vertex_count, -1);
+	std::vector<float> v_score(vertex_count);
+	for (size_t v = 0; v < vertex_count; ++v) {
+		v_score[v] = vertex_score(-1, remaining[v]);
+	}
+	std::vector<float> t_score(tri_count);
+	std::vector<bool> drawn(tri_count, false);
+	uint32_t best = 0;
+	for (size_t t = 0; t < tri_count; ++t) {
+		const Index* tri = indices + t * 3;
+		t_score[t] = v_score[tri[0]] + v_score[tri[1]] + v_score[tri[2]];
+		best = t_score[t] > t_score[best] ? uint32_t(t) : best;
+	}
+
+	// the vertex score change goes to every triangle still using it
+	auto rescore = [&](uint32_t v) {
+		float score = vertex_score(cache_pos[v], remaining[v]);
+		float delta = score - v_score[v];
+		v_score[v] = score;
+		for (uint32_t k = offsets[v]; k < offsets[v] + remaining[v]; ++k) {
+			t_score[adjacency[k]] += delta;
+		}
+	};
+
+	std::vector<Index> reordered;
+	reordered.reserve(tri_count * 3);
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> next_cache;
+	cache.reserve(score_cache_size + 3);
+	next_cache.reserve(score_cache_size + 3);
+	size_t cursor = 0;
+	while (reordered.size() < tri_count * 3) {
+		if (best == no_triangle) {
+			// nothing left around the cache, the next triangle in input order starts over
+			while (drawn[cursor]) {
+				++cursor;
+			}
+			best = uint32_t(cursor);
+		}
+
+		drawn[best] = true;
+		const Index* tri = indices + size_t(best) * 3;
+		reordered.insert(reordered.end(), tri, tri + 3);
+
+		for (int k = 0; k < 3; ++k) {
+			uint32_t v = tri[k];
+			uint32_t* begin = &adjacency[offsets[v]];
+			uint32_t* end = begin + remaining[v];
+			uint32_t* it = std::find(begin, end, best);
+			if (it != end) {
+				std::swap(*it, *(end - 1));
+				--remaining[v];
+			}
+		}
+
+		// LRU, the triangle's vertices move to the front
+		next_cache.assign(tri, tri + 3);
+		for (uint32_t v : cache) {
+			if (v != tri[0] && v != tri[1] && v != tri[2]) {
+				next_cache.push_back(v);
+			}
+		}
+		for (size_t i = score_cache_size; i < next_cache.size(); ++i) {
+			cache_pos[next_cache[i]] = -1;
+			rescore(next_cache[i]);
+		}
+		next_cache.resize(std::min<size_t>(next_cache.size(), score_cache_size));
+		cache.swap(next_cache);
+		for (size_t i = 0; i < cache.size(); ++i) {
+			cache_pos[cache[i]] = int(i);
+			rescore(cache[i]);
+		}
+
+		// the next one is among the triangles around the cache
+		best = no_triangle;
+		float best_score = -1.0f;
+		for (uint32_t v : cache) {
+			for (uint32_t k = offsets[v]; k < offsets[v] + remaining[v]; ++k) {
+				uint32_t t = adjacency[k];
+				if (t_score[t] > best_score) {
+					best_score = t_score[t];
+					best = t;
+				}
+			}
+		}
+	}
+
+	std::copy(reordered.begin(), reordered.end(), indices);
+}
+
+template <typename Index>
+void optimize_overdraw(Index* indices,
+						size_t index_count,
+						const float* positions,
+						size_t vertex_count,
+						size_t position_stride,
+						float threshold) {
+	size_t tri_count = index_count / 3;
+	if (tri_count == 0) {
+		return;
+	}
+
+	// first triangle of every cluster. A new one starts where the cache is cold anyway,
+	// or as soon as the current one is cheap enough
+	float mesh_acmr = analyze_vertex_cache(indices, tri_count * 3, vertex_count).acmr;
+	std::vector<uint32_t> clusters(1, 0);
+	FifoCache cache(vertex_count, 16);
+	uint32_t cluster_misses = 0;
+	for (size_t t = 0; t < tri_count; ++t) {
+		size_t cluster_size = t - clusters.back();
+		if (cluster_size > 0 && float(cluster_misses) <= mesh_acmr * threshold * float(cluster_size)) {
+			clusters.push_back(uint32_t(t));
+			cluster_misses = 0;
+			cache.cold();
+		}
+		uint32_t misses = cache.triangle(indices + t * 3);
+		if (misses == 3 && t > clusters.back()) {
+			clusters.push_back(uint32_t(t));
+			cluster_misses = 0;
+		}
+		cluster_misses += misses;
+	}
+	clusters.push_back(uint32_t(tri_count));
+
+	// area weighted centroid and normal of every cluster
+	size_t cluster_count = clusters.size() - 1;
+	std::vector<glm::vec3> centroids(cluster_count, glm::vec3(0.0f));
+	std::vector<glm::vec3> normals(cluster_count, glm::vec3(0.0f));
+	std::vector<float> areas(cluster_count, 0.0f);
+	glm::vec3 mesh_centroid(0.0f);
+	float mesh_area = 0.0f;
+	for (size_t c = 0; c < cluster_count; ++c) {
+		for (size_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+			glm::vec3 p0 = position(positions, position_stride, indices[t * 3]);
+			glm::vec3 p1 = position(positions, position_stride, indices[t * 3 + 1]);
+			glm::vec3 p2 = position(positions, position_stride, indices[t * 3 + 2]);
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(n);
+			centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+			normals[c] += n;
+			areas[c] += area;
+		}
+		mesh_centroid += centroids[c];
+		mesh_area += areas[c];
+	}
+	if (mesh_area > 0.0f) {
+		mesh_centroid /= mesh_area;
+	}
+
+	// how far out of the mesh a cluster faces
+	std::vector<float> keys(cluster_count, 0.0f);
+	for (size_t c = 0; c < cluster_count; ++c) {
+		float normal_length = glm::length(normals[c]);
+		if (areas[c] > 0.0f && normal_length > 0.0f) {
+			keys[c] = glm::dot(centroids[c] / areas[c] - mesh_centroid, normals[c] / normal_length);
+		}
+	}
+	std::vector<uint32_t> order(cluster_count);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+	std::vector<Index> reordered;
+	reordered.reserve(tri_count * 3);
+	for (uint32_t c : order) {
+		reordered.insert(reordered.end(), indices + size_t(clusters[c]) * 3, indices + size_t(clusters[c + 1]) * 3);
+	}
+	std::copy(reordered.begin(), reordered.end(), indices);
+}
+
+template <typename Index>
+std::vector<uint32_t> optimize_vertex_fetch(Index* indices, size_t index_count, size_t vertex_count) {
+	std::vector<uint32_t> remap(vertex_count, UINT32_MAX);
+	uint32_t next = 0;
+	for (size_t i = 0; i < index_count; ++i) {
+		uint32_t& v = remap[indices[i]];
+		if (v == UINT32_MAX) {
+			v = next++;
+		}
+		indices[i] = Index(v);
+	}
+	for (uint32_t& v : remap) {
+		if (v == UINT32_MAX) {
+			v = next++;
+		}
+	}
+	return remap;
+}
+
+template <typename Index>
+Report optimize(Index* indices,
+				size_t index_count,
+				size_t vertex_count,
+				std::vector<uint32_t>& remap,
+				const float* positions,
+				size_t position_stride,
+				float overdraw_threshold) {
+	Report report;
+	report.before = analyze_vertex_cache(indices, index_count, vertex_count);
+	optimize_vertex_cache(indices, index_count, vertex_count);
+	if (positions) {
+		optimize_overdraw(indices, index_count, positions, vertex_count, position_stride, overdraw_threshold);
+	}
+	remap = optimize_vertex_fetch(indices, index_count, vertex_count);
+	report.after = analyze_vertex_cache(indices, index_count, vertex_count);
+	return report;
+}
+
+#define INSTANTIATE_MESH_OPTIMIZE(Index) \
+	template CacheStats analyze_vertex_cache<Index>(const Index*, size_t, size_t, uint32_t); \
+	template void optimize_vertex_cache<Index>(Index*, size_t, size_t); \
+	template void optimize_overdraw<Index>(Index*, size_t, const float*, size_t, size_t, float); \
+	template std::vector<uint32_t> optimize_vertex_fetch<Index>(Index*, size_t, size_t); \
+	template Report optimize<Index>(Index*, size_t, size_t, std::vector<uint32_t>&, const float*, size_t, float);
+
+INSTANTIATE_MESH_OPTIMIZE(uint16_t)
+INSTANTIATE_MESH_OPTIMIZE(uint32_t)
+
+#undef INSTANTIATE_MESH_OPTIMIZE
+
+}
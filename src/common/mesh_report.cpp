@@ -0,0 +1,46 @@
+// Vertex cache stats of the procedural shapes, as generated and after mesh_optimize.
+// usage: mesh_report
+//
+// ACMR: vertices transformed per triangle, ATVR: per vertex. Both on a FIFO cache of 16 vertices
+
+#include <cstdio>
+#include <vector>
+
+#include "mesh_optimize.h"
+#include "procedural_shapes.h"
+
+namespace {
+
+void print(const char* name, size_t vertices, size_t triangles, const mesh::Report& report) {
+	printf("%-22s %8zu %9zu %8.3f %8.3f %8.3f %8.3f\n", name, vertices, triangles,
+			report.before.acmr, report.after.acmr, report.before.atvr, report.after.atvr);
+}
+
+}
+
+int main() {
+	printf("%-22s %8s %9s %8s %8s %8s %8s\n", "mesh", "vertices", "triangles", "acmr", "-> acmr", "atvr", "-> atvr");
+
+	char name[64];
+	for (int lod = 0; lod <= 5; ++lod) {
+		std::vector<ProceduralShapes::Vertex<ProceduralShapes::POS_NORM_UV_TANGENT>> vb;
+		std::vector<uint32_t> ib;
+		mesh::Report report;
+		ProceduralShapes::gen_ico_sphere(vb, ib, 1.0f, lod, ProceduralShapes::TRIANGLE, &report);
+		snprintf(name, sizeof(name), "ico sphere lod %d", lod);
+		print(name, vb.size(), ib.size() / 3, report);
+	}
+	for (int sectors : {16, 64}) {
+		std::vector<float> pb;
+		std::vector<uint32_t> ib;
+		mesh::Report report;
+		ProceduralShapes::gen_z_cylinder(pb, ib, 1.0f, 2.0f, sectors, sectors / 2, ProceduralShapes::TRIANGLE, &report);
+		snprintf(name, sizeof(name), "cylinder %dx%d", sectors, sectors / 2);
+		print(name, pb.size() / 3, ib.size() / 3, report);
+
+		ProceduralShapes::gen_z_capsule(pb, ib, 1.0f, 2.0f, sectors, sectors / 4, ProceduralShapes::TRIANGLE, &report);
+		snprintf(name, sizeof(name), "capsule %dx%d", sectors, sectors / 4);
+		print(name, pb.size() / 3, ib.size() / 3, report);
+	}
+	return 0;
+}
@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "mip_chain.h"
+#include "allocator.h"
+#include "parallel.h"
+
+namespace io {
+
+namespace {
+
+// Rows of the first level per band. Down to band_levels levels below, a band only reads its own rows,
+// so bands are built independently. The few levels left are tiny and built afterwards
+const uint32_t band_levels = 6;
+const uint32_t band_rows = 1u << band_levels;
+
+struct Level {
+	uint8_t* data;
+	uint32_t width;
+	uint32_t height;
+};
+
+struct SrgbTables {
+	uint16_t to_linear[256];	// 16 bit fixed point
+	uint8_t to_srgb[65536];
+
+	SrgbTables() {
+		for (int i = 0; i < 256; ++i) {
+			double c = i / 255.0;
+			double l = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+			to_linear[i] = uint16_t(std::lround(l * 65535.0));
+		}
+		for (int i = 0; i < 65536; ++i) {
+			double l = i / 65535.0;
+			double c = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+			to_srgb[i] = uint8_t(std::lround(c * 255.0));
+		}
+	}
+};
+
+const SrgbTables& srgb_tables() {
+	static SrgbTables tables;
+	return tables;
+}
+
+// one output texel from the 2x2 texels a b / c d
+
+void box_texel(uint8_t* dst, const uint8_t* a, const uint8_t* b, const uint8_t* c, const uint8_t* d, uint32_t channels) {
+	for (uint32_t i = 0; i < channels; ++i) {
+		dst[i] = uint8_t((a[i] + b[i] + c[i] + d[i] + 2) >> 2);
+	}
+}
+
+// table lookups all the way, SSE2 has no gather to speed this up
+void srgb_texel(uint8_t* dst, const uint8_t* a, const uint8_t* b, const uint8_t* c, const uint8_t* d) {
+	const SrgbTables& t = srgb_tables();
+	for (int i = 0; i < 3; ++i) {
+		uint32_t sum = t.to_linear[a[i]] + t.to_linear[b[i]] + t.to_linear[c[i]] + t.to_linear[d[i]];
+		dst[i] = t.to_srgb[(sum + 2) >> 2];
+	}
+	dst[3] = uint8_t((a[3] + b[3] + c[3] + d[3] + 2) >> 2);
+}
+
+void normal_texel(uint8_t* dst, const uint8_t* a, const uint8_t* b, const uint8_t* c, const uint8_t* d) {
+	float n[3];
+	for (int i = 0; i < 3; ++i) {
+		n[i] = float(a[i] + b[i] + c[i] + d[i]) * (2.0f / 1020.0f) - 1.0f;
+	}
+	float len2 = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+	if (len2 < 1e-8f) {
+		// opposite normals cancelling out, point straight out of the surface
+		n[0] = 0.0f;
+		n[1] = 0.0f;
+		n[2] = 1.0f;
+	} else {
+		float len = std::sqrt(len2);
+		for (float& v : n) {
+			v /= len;
+		}
+	}
+	for (int i = 0; i < 3; ++i) {
+		dst[i] = uint8_t(n[i] * 127.5f + 127.5f + 0.5f);
+	}
+	dst[3] = uint8_t((a[3] + b[3] + c[3] + d[3] + 2) >> 2);
+}
+
+#if defined(__SSE2__)
+
+// 16 bit sums of two output texels, from four RGBA8 texels of each row.
+// The first texel in lanes 0 to 3, the second in 4 to 7
+inline __m128i box_sums_rgba8(const uint8_t* r0, const uint8_t* r1) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = _mm_loadu_si128((const __m128i*)r0);
+	__m128i b = _mm_loadu_si128((const __m128i*)r1);
+	__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+	__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+	// horizontal pairs
+	lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+	hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+	return _mm_unpacklo_epi64(lo, hi);
+}
+
+// two output texels
+void box_rgba8_sse2(uint8_t* dst, const uint8_t* r0, const uint8_t* r1) {
+	__m128i sum = box_sums_rgba8(r0, r1);
+	sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+	_mm_storel_epi64((__m128i*)dst, _mm_packus_epi16(sum, sum));
+}
+
+// eight output texels
+void box_r8_sse2(uint8_t* dst, const uint8_t* r0, const uint8_t* r1) {
+	const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+	__m128i a = _mm_loadu_si128((const __m128i*)r0);
+	__m128i b = _mm_loadu_si128((const __m128i*)r1);
+	__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, low_bytes), _mm_srli_epi16(a, 8)),
+								_mm_add_epi16(_mm_and_si128(b, low_bytes), _mm_srli_epi16(b, 8)));
+	sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+	_mm_storel_epi64((__m128i*)dst, _mm_packus_epi16(sum, sum));
+}
+
+// two output texels, one per register. Same math as normal_texel
+void normal_rgba8_sse2(uint8_t* dst, const uint8_t* r0, const uint8_t* r1) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 xyz = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	const __m128 up = _mm_set_ps(0.0f, 1.0f, 0.0f, 0.0f);
+	const __m128 min_len2 = _mm_set1_ps(1e-8f);
+
+	__m128i s = box_sums_rgba8(r0, r1);
+	__m128 sums[2] = {_mm_cvtepi32_ps(_mm_unpacklo_epi16(s, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(s, zero))};
+	__m128i texels[2];
+	for (int i = 0; i < 2; ++i) {
+		__m128 n = _mm_sub_ps(_mm_mul_ps(sums[i], _mm_set1_ps(2.0f / 1020.0f)), _mm_set1_ps(1.0f));
+		// x*x + y*y + z*z in every lane
+		__m128 sq = _mm_and_ps(_mm_mul_ps(n, n), xyz);
+		sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1)));
+		__m128 len2 = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 0, 3, 2)));
+
+		__m128 degenerate = _mm_cmplt_ps(len2, min_len2);
+		n = _mm_div_ps(n, _mm_sqrt_ps(_mm_max_ps(len2, min_len2)));
+		n = _mm_or_ps(_mm_andnot_ps(degenerate, n), _mm_and_ps(degenerate, up));
+
+		// xyz back to [0, 255], alpha straight from its sum
+		__m128 encoded = _mm_add_ps(_mm_mul_ps(n, _mm_set1_ps(127.5f)), _mm_set1_ps(127.5f));
+		__m128 alpha = _mm_mul_ps(sums[i], _mm_set1_ps(0.25f));
+		__m128 v = _mm_or_ps(_mm_and_ps(xyz, encoded), _mm_andnot_ps(xyz, alpha));
+		texels[i] = _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+	}
+	__m128i packed = _mm_packs_epi32(texels[0], texels[1]);
+	_mm_storel_epi64((__m128i*)dst, _mm_packus_epi16(packed, packed));
+}
+
+#endif
+
+void downsample_row(MipFilter filter, uint32_t channels, const Level& src, const Level& dst, uint32_t y) {
+	// odd sizes repeat the last row and column
+	const uint8_t* r0 = src.data + size_t(2 * y) * src.width * channels;
+	const uint8_t* r1 = src.data + size_t(std::min(2 * y + 1, src.height - 1)) * src.width * channels;
+	uint8_t* out = dst.data + size_t(y) * dst.width * channels;
+
+	uint32_t x = 0;
+#if defined(__SSE2__)
+	// whole pairs of input texels only, the rest goes through the scalar path
+	const uint32_t pairs = src.width / 2;
+	if (channels == 1) {
+		for (; x + 8 <= pairs; x += 8) {
+			box_r8_sse2(out + x, r0 + 2 * x, r1 + 2 * x);
+		}
+	} else if (filter == MipFilter::Linear) {
+		for (; x + 2 <= pairs; x += 2) {
+			box_rgba8_sse2(out + 4 * x, r0 + 8 * x, r1 + 8 * x);
+		}
+	} else if (filter == MipFilter::Normal) {
+		for (; x + 2 <= pairs; x += 2) {
+			normal_rgba8_sse2(out + 4 * x, r0 + 8 * x, r1 + 8 * x);
+		}
+	}
+#endif
+
+	for (; x < dst.width; ++x) {
+		size_t x0 = size_t(2 * x) * channels;
+		size_t x1 = size_t(std::min(2 * x + 1, src.width - 1)) * channels;
+		uint8_t* texel = out + size_t(x) * channels;
+		if (channels == 1 || filter == MipFilter::Linear) {
+			box_texel(texel, r0 + x0, r0 + x1, r1 + x0, r1 + x1, channels);
+		} else if (filter == MipFilter::Srgb) {
+			srgb_texel(texel, r0 + x0, r0 + x1, r1 + x0, r1 + x1);
+		} else {
+			normal_texel(texel, r0 + x0, r0 + x1, r1 + x0, r1 + x1);
+		}
+	}
+}
+
+}
+
+bimg::ImageContainer* build_mip_chain(bx::AllocatorI* allocator, const bimg::ImageContainer& src, MipFilter filter) {
+	const bool single = filter == MipFilter::Linear && src.m_format == bimg::TextureFormat::R8;
+	const bimg::TextureFormat::Enum format = single ? bimg::TextureFormat::R8 : bimg::TextureFormat::RGBA8;
+	const uint32_t channels = single ? 1 : 4;
+
+	bimg::ImageContainer* chain = bimg::imageAlloc(allocator,
+													format,
+													uint16_t(src.m_width),
+													uint16_t(src.m_height),
+													1,
+													1,
+													false,
+													true);
+	if (!chain) {
+		return nullptr;
+	}
+
+	std::vector<Level> levels(chain->m_numMips);
+	for (uint8_t lod = 0; lod < chain->m_numMips; ++lod) {
+		bimg::ImageMip mip;
+		bimg::imageGetRawData(*chain, 0, lod, chain->m_data, chain->m_size, mip);
+		levels[lod] = {const_cast<uint8_t*>(mip.m_data), mip.m_width, mip.m_height};
+	}
+
+	// the first level, converted straight into the chain
+	bimg::ImageMip top;
+	bimg::imageGetRawData(src, 0, 0, src.m_data, src.m_size, top);
+	if (src.m_format == format) {
+		memcpy(levels[0].data, top.m_data, size_t(levels[0].width) * levels[0].height * channels);
+	} else {
+		mem::ScratchScope scratch;
+		if (!bimg::imageConvert(scratch.allocator(),
+								levels[0].data,
+								format,
+								top.m_data,
+								src.m_format,
+								top.m_width,
+								top.m_height,
+								1)) {
+			bimg::imageFree(chain);
+			return nullptr;
+		}
+	}
+
+	const uint32_t banded = std::min<uint32_t>(band_levels, uint32_t(levels.size()) - 1);
+	const size_t bands = (levels[0].height + band_rows - 1) / band_rows;
+	par::parallel_for(bands, [&](size_t begin, size_t end, unsigned) {
+		for (size_t band = begin; band < end; ++band) {
+			for (uint32_t lod = 1; lod <= banded; ++lod) {
+				uint32_t y0 = std::min(levels[lod].height, uint32_t(band * band_rows) >> lod);
+				uint32_t y1 = std::min(levels[lod].height, uint32_t((band + 1) * band_rows) >> lod);
+				for (uint32_t y = y0; y < y1; ++y) {
+					downsample_row(filter, channels, levels[lod - 1], levels[lod], y);
+				}
+			}
+		}
+	});
+
+	for (uint32_t lod = banded + 1; lod < levels.size(); ++lod) {
+		for (uint32_t y = 0; y < levels[lod].height; ++y) {
+			downsample_row(filter, channels, levels[lod - 1], levels[lod], y);
+		}
+	}
+	return chain;
+}
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "bimg/bimg.h"
+#include "bx/allocator.h"
+
+namespace io {
+
+// how texels are averaged down the chain
+enum class MipFilter {
+	Linear,	// plain 2x2 box, data maps: roughness, metallic, ao, height
+	Srgb,	// box filter in linear space, alpha left linear. Albedo, skybox faces
+	Normal,	// xyz averaged in [-1, 1] then renormalized, alpha box filtered. Tangent space normal maps
+};
+
+// Copy of the first mip of src with a full chain below it, allocated from allocator. src is left alone.
+// Single channel 8 bit images stay R8 with the Linear filter, anything else becomes RGBA8.
+// Levels are built in bands of rows across the workers, SSE2 where available
+bimg::ImageContainer* build_mip_chain(bx::AllocatorI* allocator, const bimg::ImageContainer& src, MipFilter filter);
+
+}
@@ -0,0 +1,75 @@
+#include <algorithm>
+
+#include "orm.h"
+#include "allocator.h"
+
+namespace io {
+
+bimg::ImageContainer* pack_orm(bx::AllocatorI* allocator,
+								const bimg::ImageContainer* ao,
+								const bimg::ImageContainer* roughness,
+								const bimg::ImageContainer* metallic,
+								const bimg::ImageContainer* height) {
+	const bimg::ImageContainer* maps[4] = {ao, roughness, metallic, height};
+	const uint8_t defaults[4] = {orm_default_ao, orm_default_roughness, orm_default_metallic, orm_default_height};
+
+	uint32_t width = 0;
+	uint32_t height_px = 0;
+	for (const bimg::ImageContainer* map : maps) {
+		if (map && map->m_width * map->m_height > width * height_px) {
+			width = map->m_width;
+			height_px = map->m_height;
+		}
+	}
+	if (width == 0) {
+		return nullptr;
+	}
+
+	bimg::ImageContainer* packed = bimg::imageAlloc(allocator,
+													bimg::TextureFormat::RGBA8,
+													uint16_t(width),
+													uint16_t(height_px),
+													1,
+													1,
+													false,
+													false);
+	if (!packed) {
+		return nullptr;
+	}
+	uint8_t* dst = (uint8_t*)packed->m_data;
+
+	mem::ScratchScope scratch;
+	for (int channel = 0; channel < 4; ++channel) {
+		const bimg::ImageContainer* map = maps[channel];
+		if (!map) {
+			for (size_t i = 0; i < size_t(width) * height_px; ++i) {
+				dst[i * 4 + channel] = defaults[channel];
+			}
+			continue;
+		}
+
+		// R8 is read as is, anything else through a RGBA8 copy
+		const uint8_t* src = (const uint8_t*)map->m_data;
+		uint32_t stride = 1;
+		if (map->m_format != bimg::TextureFormat::R8) {
+			bimg::ImageContainer* rgba8 = bimg::imageConvert(scratch.allocator(), bimg::TextureFormat::RGBA8, *map, false);
+			if (!rgba8) {
+				bimg::imageFree(packed);
+				return nullptr;
+			}
+			src = (const uint8_t*)rgba8->m_data;
+			stride = 4;
+		}
+
+		for (uint32_t y = 0; y < height_px; ++y) {
+			const uint8_t* row = src + size_t(y * map->m_height / height_px) * map->m_width * stride;
+			uint8_t* out = dst + size_t(y) * width * 4 + channel;
+			for (uint32_t x = 0; x < width; ++x) {
+				out[x * 4] = row[size_t(x * map->m_width / width) * stride];
+			}
+		}
+	}
+	return packed;
+}
+
+}
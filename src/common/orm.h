@@ -0,0 +1,24 @@
+#pragma once
+
+#include "bimg/bimg.h"
+#include "bx/allocator.h"
+
+namespace io {
+
+// Single channel maps of a material set packed into one RGBA texture:
+// r: ambient occlusion, g: roughness, b: metallic, a: height.
+// A missing map gets its channel's default
+const uint8_t orm_default_ao = 255;
+const uint8_t orm_default_roughness = 255;
+const uint8_t orm_default_metallic = 0;
+const uint8_t orm_default_height = 0;
+
+// RGBA8, first level only. Any map can be null, at least one is not.
+// Only the first channel of each map is read. They are resampled, nearest, to the size of the largest one
+bimg::ImageContainer* pack_orm(bx::AllocatorI* allocator,
+								const bimg::ImageContainer* ao,
+								const bimg::ImageContainer* roughness,
+								const bimg::ImageContainer* metallic,
+								const bimg::ImageContainer* height);
+
+}
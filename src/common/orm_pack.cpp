@@ -0,0 +1,82 @@
+// Packs the single channel maps of a material set into one RGBA8 .ktx, see io::pack_orm.
+// usage: orm_pack <output.ktx> <ao> <roughness> <metallic> <height>
+//
+// '-' for a missing map. The output has no mips, texturec compresses it and builds them
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "bx/error.h"
+#include "bx/file.h"
+#include "bimg/bimg.h"
+#include "bimg/decode.h"
+
+#include "allocator.h"
+#include "orm.h"
+
+namespace {
+
+bimg::ImageContainer* load(const std::string& name) {
+	if (name == "-") {
+		return nullptr;
+	}
+	std::ifstream file(name, std::ios::binary);
+	std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (data.empty()) {
+		std::cout << "Cannot open " << name << std::endl;
+		return nullptr;
+	}
+	bx::Error err;
+	bimg::ImageContainer* image = bimg::imageParse(&mem::default_allocator(),
+													data.data(),
+													uint32_t(data.size()),
+													bimg::TextureFormat::Count,
+													&err);
+	if (!image) {
+		std::cout << "Cannot decode " << name << ", " << err.getMessage().getPtr() << std::endl;
+	}
+	return image;
+}
+
+}
+
+int main(int argc, char** argv) {
+	if (argc != 6) {
+		std::cout << "usage: orm_pack <output.ktx> <ao> <roughness> <metallic> <height>" << std::endl;
+		return 1;
+	}
+	const char* output = argv[1];
+
+	bimg::ImageContainer* maps[4];
+	for (int i = 0; i < 4; ++i) {
+		maps[i] = load(argv[2 + i]);
+	}
+	bimg::ImageContainer* packed = io::pack_orm(&mem::default_allocator(), maps[0], maps[1], maps[2], maps[3]);
+	for (bimg::ImageContainer* map : maps) {
+		if (map) {
+			bimg::imageFree(map);
+		}
+	}
+	if (!packed) {
+		std::cout << "Nothing to pack into " << output << std::endl;
+		return 1;
+	}
+
+	bx::FileWriter writer;
+	bx::Error err;
+	if (bx::open(&writer, output, false, &err)) {
+		bimg::imageWriteKtx(&writer, *packed, packed->m_data, packed->m_size, &err);
+		bx::close(&writer);
+	}
+	std::cout << "orm " << packed->m_width << "x" << packed->m_height << " -> " << output << std::endl;
+	bimg::imageFree(packed);
+
+	if (!err.isOk()) {
+		std::cout << "Cannot write " << output << ", " << err.getMessage().getPtr() << std::endl;
+		return 1;
+	}
+	return 0;
+}
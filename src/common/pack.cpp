@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pack.h"
+
+namespace io {
+
+std::string normalize_path(const std::string& path) {
+	std::vector<std::string> parts;
+	size_t begin = 0;
+	while (begin <= path.size()) {
+		size_t end = path.find('/', begin);
+		if (end == std::string::npos) {
+			end = path.size();
+		}
+		std::string part = path.substr(begin, end - begin);
+		if (part == "..") {
+			if (!parts.empty() && parts.back() != "..") {
+				parts.pop_back();
+			} else {
+				parts.push_back(part);
+			}
+		} else if (!part.empty() && part != ".") {
+			parts.push_back(part);
+		}
+		begin = end + 1;
+	}
+
+	std::string normalized;
+	for (const std::string& part : parts) {
+		if (!normalized.empty()) {
+			normalized += '/';
+		}
+		normalized += part;
+	}
+	return normalized;
+}
+
+bool write_pack(const char* path, std::vector<std::pair<std::string, std::string>> files) {
+	for (auto& f : files) {
+		f.first = normalize_path(f.first);
+	}
+	std::sort(files.begin(), files.end());
+	files.erase(std::unique(files.begin(), files.end(),
+							[](const std::pair<std::string, std::string>& a, const std::pair<std::string, std::string>& b) {
+								return a.first == b.first;
+							}),
+				files.end());
+
+	PackHeader header;
+	memcpy(header.magic, "APAK", 4);
+	header.version = pack_version;
+	header.entry_count = uint32_t(files.size());
+	header.alignment = pack_alignment;
+	header.index_offset = sizeof(PackHeader);
+	header.names_offset = header.index_offset + files.size() * sizeof(PackEntry);
+
+	std::vector<PackEntry> index(files.size());
+	std::string names;
+	for (size_t i = 0; i < files.size(); ++i) {
+		index[i].name_offset = uint32_t(names.size());
+		index[i].name_size = uint32_t(files[i].first.size());
+		names += files[i].first;
+	}
+
+	auto align = [](uint64_t offset) {
+		return (offset + pack_alignment - 1) / pack_alignment * pack_alignment;
+	};
+	uint64_t offset = align(header.names_offset + names.size());
+	for (size_t i = 0; i < files.size(); ++i) {
+		struct stat st;
+		if (stat(files[i].second.c_str(), &st) != 0) {
+			std::cout << "Cannot open " << files[i].second << std::endl;
+			return false;
+		}
+		index[i].offset = offset;
+		index[i].size = uint64_t(st.st_size);
+		offset = align(offset + index[i].size);
+	}
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)index.data(), std::streamsize(index.size() * sizeof(PackEntry)));
+	out.write(names.data(), std::streamsize(names.size()));
+
+	std::vector<char> blob;
+	for (size_t i = 0; i < files.size() && out; ++i) {
+		// padding up to the blob
+		out.seekp(std::streamoff(index[i].offset));
+		std::ifstream in(files[i].second, std::ios::binary);
+		blob.resize(size_t(index[i].size));
+		if (!in.read(blob.data(), std::streamsize(blob.size()))) {
+			std::cout << "Cannot read " << files[i].second << std::endl;
+			return false;
+		}
+		out.write(blob.data(), std::streamsize(blob.size()));
+	}
+	if (!out) {
+		std::cout << "Cannot write " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+AssetPack::AssetPack() : _data(nullptr), _size(0), _index(nullptr), _names(nullptr), _count(0) {}
+
+AssetPack::~AssetPack() {
+	close();
+}
+
+bool AssetPack::open(const char* path) {
+	close();
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(PackHeader)) {
+		::close(fd);
+		return false;
+	}
+	size_t size = size_t(st.st_size);
+	void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	const PackHeader* header = (const PackHeader*)data;
+	bool valid = memcmp(header->magic, "APAK", 4) == 0 &&
+					header->version == pack_version &&
+					header->alignment == pack_alignment &&
+					header->index_offset % alignof(PackEntry) == 0 &&
+					header->index_offset <= size &&
+					(size - header->index_offset) / sizeof(PackEntry) >= header->entry_count &&
+					header->names_offset <= size;
+	// every name and blob inside the file, find() reads them without checking
+	const PackEntry* index = valid ? (const PackEntry*)((const uint8_t*)data + header->index_offset) : nullptr;
+	for (uint32_t i = 0; valid && i < header->entry_count; ++i) {
+		const PackEntry& e = index[i];
+		valid = uint64_t(e.name_offset) + e.name_size <= size - header->names_offset &&
+				e.offset <= size &&
+				size - e.offset >= e.size;
+	}
+	if (!valid) {
+		std::cout << path << " is not an asset pack" << std::endl;
+		munmap(data, size);
+		return false;
+	}
+
+	_data = (const uint8_t*)data;
+	_size = size;
+	_index = (const PackEntry*)(_data + header->index_offset);
+	_names = (const char*)(_data + header->names_offset);
+	_count = header->entry_count;
+	// blobs are read on demand, the index right away
+	madvise(data, size_t(header->names_offset), MADV_WILLNEED);
+	return true;
+}
+
+void AssetPack::close() {
+	if (_data) {
+		munmap((void*)_data, _size);
+	}
+	_data = nullptr;
+	_size = 0;
+	_index = nullptr;
+	_names = nullptr;
+	_count = 0;
+}
+
+bool AssetPack::is_open() const {
+	return _data != nullptr;
+}
+
+const uint8_t* AssetPack::find(const std::string& name, size_t& size) const {
+	if (!_data) {
+		return nullptr;
+	}
+	std::string key = normalize_path(name);
+	auto less = [this](const PackEntry& e, const std::string& k) {
+		return k.compare(0, std::string::npos, _names + e.name_offset, e.name_size) > 0;
+	};
+	const PackEntry* e = std::lower_bound(_index, _index + _count, key, less);
+	if (e == _index + _count || key.compare(0, std::string::npos, _names + e->name_offset, e->name_size) != 0) {
+		return nullptr;
+	}
+	size = size_t(e->size);
+	return _data + e->offset;
+}
+
+}
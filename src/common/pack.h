@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace io {
+
+// Single file asset pack:
+// header | index, sorted by name | names | blobs, each starting on a multiple of alignment.
+// Names are relative paths as the application asks for them, normalized by normalize_path
+struct PackHeader {
+	char magic[4];			// "APAK"
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t alignment;
+	uint64_t index_offset;	// PackEntry[entry_count]
+	uint64_t names_offset;
+};
+
+struct PackEntry {
+	uint64_t offset;		// of the blob
+	uint64_t size;
+	uint32_t name_offset;	// from names_offset, not nul terminated
+	uint32_t name_size;
+};
+
+const uint32_t pack_version = 1;
+// pages, so every blob can be handed out and madvise'd on its own
+const uint32_t pack_alignment = 4096;
+
+// "./a/b/../c" -> "a/c". Leading ".." are kept
+std::string normalize_path(const std::string& path);
+
+// files: name in the pack, path of the file to read it from. False on any read or write error
+bool write_pack(const char* path, std::vector<std::pair<std::string, std::string>> files);
+
+// Read only view of a pack, mapped once. Lookups are thread safe
+class AssetPack {
+public:
+	AssetPack();
+	~AssetPack();
+
+	AssetPack(const AssetPack&) = delete;
+	AssetPack& operator=(const AssetPack&) = delete;
+
+	// false if path is missing or not a pack. Closes the previous one
+	bool open(const char* path);
+
+	// views handed out before are invalid afterwards
+	void close();
+
+	bool is_open() const;
+
+	// view into the mapping, nullptr if name is not in the pack
+	const uint8_t* find(const std::string& name, size_t& size) const;
+
+private:
+	const uint8_t* _data;
+	size_t _size;
+	const PackEntry* _index;
+	const char* _names;
+	uint32_t _count;
+};
+
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace par {
+
+inline unsigned worker_count() {
+	unsigned n = std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+// true on the threads of any ThreadPool
+inline bool& in_pool_worker() {
+	static thread_local bool worker = false;
+	return worker;
+}
+
+// Fixed set of workers running submitted tasks in submission order.
+// The destructor finishes the queued tasks before joining
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned count = worker_count()) : _stop(false) {
+		for (unsigned i = 0; i < count; ++i) {
+			_threads.emplace_back([this]() { run(); });
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_cv.notify_all();
+		for (std::thread& t : _threads) {
+			t.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	template <typename Fn>
+	auto submit(Fn fn) -> std::future<decltype(fn())> {
+		typedef decltype(fn()) Result;
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::move(fn));
+		std::future<Result> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_tasks.emplace_back([task]() { (*task)(); });
+		}
+		_cv.notify_one();
+		return result;
+	}
+
+private:
+	void run() {
+		in_pool_worker() = true;
+		for (;;) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_cv.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+				if (_tasks.empty()) {
+					return;
+				}
+				task = std::move(_tasks.front());
+				_tasks.pop_front();
+			}
+			task();
+		}
+	}
+
+	std::vector<std::thread> _threads;
+	std::deque<std::function<void()>> _tasks;
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	bool _stop;
+};
+
+// workers of parallel_for, started once
+inline ThreadPool& compute_pool() {
+	static ThreadPool pool;
+	return pool;
+}
+
+// Splits [0, count) into one contiguous range per worker and calls fn(begin, end, worker) on each,
+// worker being in [0, worker_count()). The calling thread takes the first range, compute_pool the others.
+// On a pool worker, loading a texture say, everything runs on the calling thread: the cores are busy already.
+// Returns once every range is done
+template <typename Fn>
+void parallel_for(size_t count, Fn fn) {
+	size_t workers = in_pool_worker() ? 1 : std::min<size_t>(worker_count(), count);
+	if (workers <= 1) {
+		if (count > 0) {
+			fn(size_t(0), count, 0u);
+		}
+		return;
+	}
+
+	size_t chunk = (count + workers - 1) / workers;
+	std::vector<std::future<void>> ranges;
+	ranges.reserve(workers - 1);
+	for (size_t w = 1; w < workers; ++w) {
+		size_t begin = w * chunk;
+		size_t end = std::min(count, begin + chunk);
+		if (begin >= end) {
+			break;
+		}
+		ranges.push_back(compute_pool().submit([&fn, begin, end, w]() { fn(begin, end, unsigned(w)); }));
+	}
+	fn(size_t(0), std::min(count, chunk), 0u);
+
+	for (std::future<void>& r : ranges) {
+		r.get();
+	}
+}
+
+}
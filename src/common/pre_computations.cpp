@@ -1,196 +1,819 @@
+#include <algorithm>
 #include <array>
+#include <cassert>
+#include <cmath>
+#include <memory>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <sys/stat.h>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "pre_computations.h"
+#include "allocator.h"
+#include "brdf_lut.h"
 
 #include "glm/matrix.hpp"
 #include "bimg/bimg.h"
 #include "bx/error.h"
+#include "bx/file.h"
+#include "bx/hash.h"
 #include "bimg/decode.h"
 #include "procedural_shapes.h"
+#include "vertex_layout.h"
 #include "file_io.h"
+#include "parallel.h"
+#include "sampling.h"
 
 namespace pcp {
 
-bgfx::TextureHandle convolute_cube_map(bgfx::TextureHandle cube_tex,
-										int res,
-										bgfx::ProgramHandle prog,
-										std::vector<UniformContext> ucs) {
-	glm::mat4 views[6] = {
-		glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),  // +x
-		glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)), // -x
-		glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f)),  // +y
-		glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f, -1.0f)),  // -y
-		glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f)),  // +z
-		glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f))   // -z
-	};
-	uint8_t side_order[6] = {
-		BGFX_CUBE_MAP_POSITIVE_X, BGFX_CUBE_MAP_NEGATIVE_X,
-		BGFX_CUBE_MAP_POSITIVE_Y, BGFX_CUBE_MAP_NEGATIVE_Y,
-		BGFX_CUBE_MAP_POSITIVE_Z, BGFX_CUBE_MAP_NEGATIVE_Z,
-	};
+namespace {
 
-	std::vector<float> vb;
-	ProceduralShapes::gen_cube(vb, ProceduralShapes::VertexAttrib::POS, glm::vec3(1.0f, 1.0f, 1.0f), ProceduralShapes::IndexType::TRIANGLE);
-	bgfx::VertexLayout layout;
-	layout.begin()
-		.add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
-	.end();
-	bgfx::VertexBufferHandle vb_hdl = bgfx::createVertexBuffer(bgfx::copy(vb.data(), vb.size() * sizeof(float)), layout);
+// views reserved for pre-computations. Application views sit below, reflection probes use 10 to 91, imgui uses 200
+const bgfx::ViewId bake_view_first = 100;
+const bgfx::ViewId bake_view_count = 98;
+// read backs of bakes. Blits have to come after the views rendering their sources
+const bgfx::ViewId bake_blit_view = bake_view_first + bake_view_count;
 
-	bgfx::TextureHandle tex_cube_map = bgfx::createTextureCube(res,
-																false,
-																1,
-																bgfx::TextureFormat::RGBA16F,
-																BGFX_SAMPLER_UVW_CLAMP | BGFX_TEXTURE_BLIT_DST);
-	bgfx::TextureHandle tex_2d_rt = bgfx::createTexture2D(res,
-														res,
-														false,
-														1,
-														bgfx::TextureFormat::RGBA16F,
-														BGFX_TEXTURE_RT);
+const glm::mat4 face_views[6] = {
+	glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),  // +x
+	glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)), // -x
+	glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f)),  // +y
+	glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f, -1.0f)),  // -y
+	glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f)),  // +z
+	glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f))   // -z
+};
+
+const char* skybox_vs_path = "../common_shaders/glsl/skybox_vs.bin";
+const char* irradiance_fs_path = "../common_shaders/glsl/irradiance_convolution_fs.bin";
+const char* prefilter_fs_path = "../common_shaders/glsl/prefilter_fs.bin";
+const char* equirect_fs_path = "../common_shaders/glsl/equirect_to_cube_fs.bin";
+
+// keep in sync with the loop count of prefilter_fs
+const int prefilter_sample_count = 64;
+
+// bump when the layout of cached bakes changes
+const uint32_t bake_cache_version = 1;
+
+}
+
+const glm::mat4& cube_face_view(int side) {
+	return face_views[side];
+}
+
+CubeBaker::CubeBaker() : CubeBaker(bake_view_first, bake_view_count) {}
+
+CubeBaker::CubeBaker(bgfx::ViewId first_view, uint16_t view_count)
+	: _first_view(first_view),
+	  _view_count(view_count) {
+	std::vector<ProceduralShapes::Vertex<ProceduralShapes::POS>> vb;
+	ProceduralShapes::gen_cube(vb, glm::vec3(1.0f, 1.0f, 1.0f), ProceduralShapes::IndexType::TRIANGLE);
+	_cube_vb = create_vertex_buffer(vb);
+
+	_s_env = bgfx::createUniform("s_env", bgfx::UniformType::Sampler);
+	_s_samples = bgfx::createUniform("s_samples", bgfx::UniformType::Sampler);
+	u_roughness = bgfx::createUniform("u_roughness", bgfx::UniformType::Vec4);
+	_samples = BGFX_INVALID_HANDLE;
+	_sample_levels = 0;
+	_irradiance_prog = io::programs().load(skybox_vs_path, irradiance_fs_path);
+	_prefilter_prog = io::programs().load(skybox_vs_path, prefilter_fs_path);
+	_equirect_prog = io::programs().load(skybox_vs_path, equirect_fs_path);
+}
+
+CubeBaker::~CubeBaker() {
+	if (!_faces.empty()) {
+		flush();
+	}
+
+	bgfx::destroy(_cube_vb);
+	bgfx::destroy(_s_env);
+	bgfx::destroy(u_roughness);
+	bgfx::destroy(_s_samples);
+	if (bgfx::isValid(_samples)) {
+		bgfx::destroy(_samples);
+	}
+}
+
+void CubeBaker::submit_face(bgfx::TextureHandle dst,
+							int dst_mip,
+							int side,
+							bgfx::TextureHandle cube_tex,
+							int res,
+							bgfx::ProgramHandle prog,
+							const std::vector<UniformContext>& ucs,
+							int tile_y,
+							int tile_height,
+							uint8_t resolve) {
+	if (capacity() == 0) {
+		flush();
+	}
+
+	// no intermediate target, nothing to blit
+	bgfx::Attachment attachment;
+	attachment.init(dst, bgfx::Access::Write, uint16_t(side), 1, uint16_t(dst_mip), resolve);
+	bgfx::FrameBufferHandle fb = bgfx::createFrameBuffer(1, &attachment);
 
-	bgfx::FrameBufferHandle fb = bgfx::createFrameBuffer(1, &tex_2d_rt, true);
 	glm::mat4 proj = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1.0f);
-	bgfx::UniformHandle s_tex = bgfx::createUniform("s_env", bgfx::UniformType::Sampler);
 	uint64_t state = 0
 		| BGFX_STATE_WRITE_RGB
 		| BGFX_STATE_WRITE_A
 		// | BGFX_STATE_WRITE_Z
 		| BGFX_STATE_DEPTH_TEST_ALWAYS;
 
+	// the cube covers every texel, no clear needed. Which also keeps the other tiles intact
+	bgfx::ViewId view = _first_view + bgfx::ViewId(_faces.size());
+	bgfx::setViewRect(view, 0, 0, res, res);
+	if (tile_height > 0) {
+		bgfx::setViewScissor(view, 0, uint16_t(tile_y), uint16_t(res), uint16_t(tile_height));
+	}
+	bgfx::setViewFrameBuffer(view, fb);
+	bgfx::setViewTransform(view, &face_views[side], &proj);
+	bgfx::setState(state);
+	bgfx::setTexture(0, _s_env, cube_tex);
+	if (bgfx::isValid(_samples)) {
+		bgfx::setTexture(1, _s_samples, _samples);
+	}
+	bgfx::setVertexBuffer(0, _cube_vb);
+	for (auto& uc : ucs) {
+		bgfx::setUniform(uc.hdl, uc.value, uc.num);
+	}
+	bgfx::submit(view, prog);
+
+	_faces.push_back(fb);
+}
+
+void CubeBaker::submit_cube(bgfx::TextureHandle dst,
+							int dst_mip,
+							bgfx::TextureHandle cube_tex,
+							int res,
+							bgfx::ProgramHandle prog,
+							const std::vector<UniformContext>& ucs) {
 	for (int i = 0; i < 6; ++i) {
-		bgfx::setViewClear(0, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH);
-		bgfx::setViewRect(0, 0, 0, res, res);
-		bgfx::setViewFrameBuffer(0, fb);
-		bgfx::setViewTransform(0, &views[i], &proj);
-		bgfx::setState(state);
-		bgfx::setTexture(0, s_tex, cube_tex);
-		bgfx::setVertexBuffer(0, vb_hdl);
-		for (auto& uc : ucs) {
-			bgfx::setUniform(uc.hdl, uc.value, uc.num);
+		submit_face(dst, dst_mip, i, cube_tex, res, prog, ucs);
+	}
+}
+
+int CubeBaker::capacity() const {
+	return _view_count - int(_faces.size());
+}
+
+uint32_t CubeBaker::flush() {
+	if (_faces.empty()) {
+		// nothing recorded, e.g. everything came from a BakeCache
+		return 0;
+	}
+	uint32_t frame = bgfx::frame();
+	release();
+	return frame;
+}
+
+void CubeBaker::release() {
+	// frame buffers of the last batch. The frame using them has been kicked off,
+	// bgfx defers the destruction until it is done
+	for (size_t i = 0; i < _faces.size(); ++i) {
+		bgfx::destroy(_faces[i]);
+		bgfx::resetView(_first_view + bgfx::ViewId(i));
+	}
+	_faces.clear();
+}
+
+bgfx::ProgramHandle CubeBaker::irradiance_prog() {
+	return io::programs().handle(_irradiance_prog);
+}
+
+bgfx::ProgramHandle CubeBaker::prefilter_prog() {
+	return io::programs().handle(_prefilter_prog);
+}
+
+bgfx::TextureHandle CubeBaker::prefilter_samples(int mip_levels) {
+	if (_sample_levels != mip_levels) {
+		// passes already recorded keep the old one alive
+		if (bgfx::isValid(_samples)) {
+			bgfx::destroy(_samples);
 		}
-		bgfx::submit(0, prog);
-		bgfx::blit(1, tex_cube_map, 0, 0, 0, side_order[i], tex_2d_rt);
-		bgfx::frame();
+		_samples = gen_sample_table(prefilter_sample_count, mip_levels);
+		_sample_levels = mip_levels;
 	}
+	return _samples;
+}
 
-	// todo: destroy stuff
-	bgfx::destroy(s_tex);
-	bgfx::destroy(fb);
-	bgfx::destroy(vb_hdl);
+bgfx::ProgramHandle CubeBaker::equirect_prog() {
+	return io::programs().handle(_equirect_prog);
+}
+
+bgfx::TextureHandle convolute_cube_map(bgfx::TextureHandle cube_tex,
+										int res,
+										bgfx::ProgramHandle prog,
+										std::vector<UniformContext> ucs) {
+	bgfx::TextureHandle tex_cube_map = bgfx::createTextureCube(res,
+																false,
+																1,
+																bgfx::TextureFormat::RGBA16F,
+																BGFX_SAMPLER_UVW_CLAMP | BGFX_TEXTURE_RT);
+	CubeBaker baker;
+	baker.submit_cube(tex_cube_map, 0, cube_tex, res, prog, ucs);
+	baker.flush();
 
 	return tex_cube_map;
 }
 
 
 bgfx::TextureHandle gen_irradiance_map(bgfx::TextureHandle cube_tex,
-										int res) {
-	bgfx::ProgramHandle prog = io::load_program("../common_shaders/glsl/skybox_vs.bin",
-												"../common_shaders/glsl/irradiance_convolution_fs.bin");
-	bgfx::TextureHandle hdl = convolute_cube_map(cube_tex, res, prog, std::vector<UniformContext>());
-	bgfx::destroy(prog);
-	return hdl;
-}
-
-void blit_cube_map(bgfx::TextureHandle dst,
-					int dst_mip,
-					bgfx::TextureHandle src,
-					int src_mip) {
-	uint8_t side_order[6] = {
-		BGFX_CUBE_MAP_POSITIVE_X, BGFX_CUBE_MAP_NEGATIVE_X,
-		BGFX_CUBE_MAP_POSITIVE_Y, BGFX_CUBE_MAP_NEGATIVE_Y,
-		BGFX_CUBE_MAP_POSITIVE_Z, BGFX_CUBE_MAP_NEGATIVE_Z,
-	};
+										int res,
+										CubeBaker* baker) {
+	std::unique_ptr<CubeBaker> local_baker;
+	if (!baker) {
+		local_baker.reset(new CubeBaker);
+	}
+	CubeBaker& b = baker ? *baker : *local_baker;
 
-	for (int i = 0; i < 6; ++i) {
-		bgfx::blit(1, dst, dst_mip, 0, 0, side_order[i], src, src_mip, 0, 0, side_order[i]);
-		bgfx::frame();
+	bgfx::TextureHandle hdl = bgfx::createTextureCube(res,
+													false,
+													1,
+													bgfx::TextureFormat::RGBA16F,
+													BGFX_SAMPLER_UVW_CLAMP | BGFX_TEXTURE_RT);
+	b.submit_cube(hdl, 0, cube_tex, res, b.irradiance_prog(), std::vector<UniformContext>());
+	if (!baker) {
+		b.flush();
 	}
+	return hdl;
 }
 
 bgfx::TextureHandle gen_prefilter_map(bgfx::TextureHandle cube_tex,
+										int src_res,
 										int res,
-										int mip_levels) {
-	bgfx::ProgramHandle prog = io::load_program("../common_shaders/glsl/skybox_vs.bin",
-												"../common_shaders/glsl/prefilter_fs.bin");
+										int mip_levels,
+										CubeBaker* baker) {
+	std::unique_ptr<CubeBaker> local_baker;
+	if (!baker) {
+		local_baker.reset(new CubeBaker);
+	}
+	CubeBaker& b = baker ? *baker : *local_baker;
 
-	bgfx::UniformHandle u_roughness = bgfx::createUniform("u_roughness", bgfx::UniformType::Vec4);
-	std::vector<UniformContext> ucs(1);
 	bgfx::TextureHandle hdl = bgfx::createTextureCube(res,
 													true,
 													1,
-													bgfx::TextureFormat::RGBA16F, BGFX_SAMPLER_UVW_CLAMP | BGFX_TEXTURE_BLIT_DST);
+													bgfx::TextureFormat::RGBA16F, BGFX_SAMPLER_UVW_CLAMP | BGFX_TEXTURE_RT);
+	// every face of every mip gets its own view and its own attachment,
+	// all of them go out in one frame
+	b.prefilter_samples(mip_levels);
 	for(int m = 0; m < mip_levels; ++m) {
-		int mip_res = res * glm::pow(0.5f, m);
-		glm::vec4 mip_roughness = glm::vec4((float)m / (float)(mip_levels - 1));
-		ucs[0] = {u_roughness, &mip_roughness, 1};
-		bgfx::TextureHandle mip_cube_tex = convolute_cube_map(cube_tex, mip_res, prog, ucs);
-		blit_cube_map(hdl, m, mip_cube_tex, 0);
-		bgfx::destroy(mip_cube_tex);
+		int mip_res = res >> m;
+		// the samples of mip m are in row m + 1 of the table
+		glm::vec4 mip_roughness = glm::vec4((float)m / (float)(mip_levels - 1), (float)src_res, (float)(m + 1), 0.0f);
+		std::vector<UniformContext> ucs = {{b.u_roughness, &mip_roughness, 1}};
+		b.submit_cube(hdl, m, cube_tex, mip_res, b.prefilter_prog(), ucs);
+	}
+	if (!baker) {
+		b.flush();
 	}
-
-	bgfx::destroy(u_roughness);
-	bgfx::destroy(prog);
 
 	return hdl;
 }
 
 bgfx::TextureHandle gen_brdf_lut(int res) {
- 	std::vector<float> vb = {
-		-1.0f,  1.0f, 0.0f,
-    	-1.0f, -1.0f, 0.0f,
-    	 1.0f, -1.0f, 0.0f,
-    	 1.0f, -1.0f, 0.0f,
-    	 1.0f,  1.0f, 0.0f,
-    	-1.0f,  1.0f, 0.0f,
-	};
+	std::vector<uint16_t> texels(size_t(res) * res * 2);
+	integrate_brdf_lut(texels.data(), res);
+	return bgfx::createTexture2D(uint16_t(res),
+								uint16_t(res),
+								false,
+								1,
+								bgfx::TextureFormat::RG16F,
+								// clamp border.
+								// Since dot(n, v) in fresnel calculations could be a little over 1.0f,
+								// wrap back to 0.0f will result in small bright circle in the middle.
+								// Document this
+								BGFX_SAMPLER_UVW_CLAMP,
+								bgfx::copy(texels.data(), uint32_t(texels.size() * sizeof(uint16_t))));
+}
+
+bgfx::TextureHandle gen_sample_table(int sample_count, int roughness_levels) {
+	const int width = sample_count;
+	const int height = 1 + roughness_levels;
+	std::vector<float> table(size_t(width) * height * 4);
+
+	for (int i = 0; i < sample_count; ++i) {
+		float phi = 2.0f * float(M_PI) * float(i) / float(sample_count);
+		float* xi = &table[size_t(i) * 4];
+		xi[0] = std::cos(phi);
+		xi[1] = std::sin(phi);
+		xi[2] = van_der_corput(uint32_t(i));
+		xi[3] = 0.0f;
+
+		for (int k = 0; k < roughness_levels; ++k) {
+			float roughness = roughness_levels > 1 ? float(k) / float(roughness_levels - 1) : 0.0f;
+			float cos_t = ggx_cos_theta(xi[2], roughness);
+			float sin_t = std::sqrt(1.0f - cos_t * cos_t);
+			float* h = &table[(size_t(k + 1) * width + i) * 4];
+			h[0] = xi[0] * sin_t;
+			h[1] = xi[1] * sin_t;
+			h[2] = cos_t;
+			// a perfect mirror has no pdf to speak of, the shader reads mip 0 for it anyway
+			h[3] = roughness > 0.0f ? distribution_ggx(cos_t, roughness) * 0.25f : 0.0f;
+		}
+	}
+
+	return bgfx::createTexture2D(uint16_t(width),
+								uint16_t(height),
+								false,
+								1,
+								bgfx::TextureFormat::RGBA32F,
+								BGFX_SAMPLER_POINT | BGFX_SAMPLER_UVW_CLAMP,
+								bgfx::copy(table.data(), uint32_t(table.size() * sizeof(float))));
+}
+
+bgfx::TextureHandle equirect_to_cube(bgfx::TextureHandle equirect, int res, CubeBaker* baker) {
+	std::unique_ptr<CubeBaker> local_baker;
+	if (!baker) {
+		local_baker.reset(new CubeBaker);
+	}
+	CubeBaker& b = baker ? *baker : *local_baker;
+
+	bgfx::TextureHandle hdl = bgfx::createTextureCube(res,
+													true,
+													1,
+													bgfx::TextureFormat::RGBA16F, BGFX_SAMPLER_UVW_CLAMP | BGFX_TEXTURE_RT);
+	// mips are generated for the whole cube, once the last face is done
+	for (int side = 0; side < 6; ++side) {
+		uint8_t resolve = side == 5 ? BGFX_RESOLVE_AUTO_GEN_MIPS : BGFX_RESOLVE_NONE;
+		b.submit_face(hdl, 0, side, equirect, res, b.equirect_prog(), std::vector<UniformContext>(), 0, 0, resolve);
+	}
+	if (!baker) {
+		b.flush();
+	}
 
-	bgfx::VertexLayout layout;
-	layout.begin()
-		.add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
-	.end();
-
-	// use bgfx::copy here insead of bgfx::makeRef.
-	// bgfx::frame only kick starts rendering,
-	// there is no telling if bgfx could complete rendering a frame before vb is released
-	bgfx::VertexBufferHandle vb_hdl = bgfx::createVertexBuffer(bgfx::copy(vb.data(), vb.size() * sizeof(float)), layout);
-	bgfx::ProgramHandle prog = io::load_program("../common_shaders/glsl/brdf_lut_vs.bin",
-												"../common_shaders/glsl/brdf_lut_fs.bin");
-
-	bgfx::TextureHandle tex_lut = bgfx::createTexture2D(res,
-														res,
-														false,
+	return hdl;
+}
+
+IncrementalBaker::IncrementalBaker(float budget_ms, int tile_rows)
+	: _budget_ms(budget_ms),
+	  _tile_rows(tile_rows),
+	  _equirect(BGFX_INVALID_HANDLE),
+	  _cube_tex(BGFX_INVALID_HANDLE),
+	  _prefilter(BGFX_INVALID_HANDLE),
+	  _src_res(0),
+	  _res(0),
+	  _mip_levels(0),
+	  _next(0),
+	  _units_per_frame(0.0),
+	  _units_last_frame(0.0),
+	  _idle_gpu_ms(-1.0) {}
+
+IncrementalBaker::~IncrementalBaker() {
+	drop();
+}
+
+void IncrementalBaker::drop() {
+	if (bgfx::isValid(_equirect)) {
+		bgfx::destroy(_equirect);
+	}
+	if (bgfx::isValid(_cube_tex)) {
+		bgfx::destroy(_cube_tex);
+	}
+	if (bgfx::isValid(_prefilter)) {
+		bgfx::destroy(_prefilter);
+	}
+	_equirect = BGFX_INVALID_HANDLE;
+	_cube_tex = BGFX_INVALID_HANDLE;
+	_prefilter = BGFX_INVALID_HANDLE;
+	_jobs.clear();
+	_next = 0;
+}
+
+void IncrementalBaker::start_equirect(bgfx::TextureHandle equirect, int cube_res, int res, int mip_levels) {
+	start(BGFX_INVALID_HANDLE, cube_res, res, mip_levels);
+	_equirect = equirect;
+}
+
+void IncrementalBaker::start(bgfx::TextureHandle cube_tex, int src_res, int res, int mip_levels) {
+	drop();
+	_cube_tex = cube_tex;
+	_src_res = src_res;
+	_res = res;
+	_mip_levels = mip_levels;
+	_prefilter = bgfx::createTextureCube(res,
+										true,
+										1,
+										bgfx::TextureFormat::RGBA16F, BGFX_SAMPLER_UVW_CLAMP | BGFX_TEXTURE_RT);
+
+	// cheapest first
+	const double samples = double(prefilter_sample_count);
+	_baker.prefilter_samples(mip_levels);
+	for (int m = mip_levels - 1; m >= 0; --m) {
+		int mip_res = res >> m;
+		for (int side = 0; side < 6; ++side) {
+			for (int y = 0; y < mip_res; y += _tile_rows) {
+				int h = std::min(_tile_rows, mip_res - y);
+				_jobs.push_back({m, side, y, h, double(mip_res) * h * samples});
+			}
+		}
+	}
+
+	if (_units_per_frame <= 0.0) {
+		// a band of the largest mip. The budget takes over from there
+		_units_per_frame = double(res) * _tile_rows * samples;
+	}
+}
+
+bool IncrementalBaker::busy() const {
+	return bgfx::isValid(_prefilter);
+}
+
+bool IncrementalBaker::update() {
+	// passes of the last update went out with the last bgfx::frame()
+	_baker.release();
+
+	// gpu time of the frames, against the time of frames without any bake pass
+	const bgfx::Stats* stats = bgfx::getStats();
+	double gpu_ms = stats->gpuTimerFreq > 0
+		? double(stats->gpuTimeEnd - stats->gpuTimeBegin) * 1000.0 / double(stats->gpuTimerFreq)
+		: 0.0;
+	if (_units_last_frame <= 0.0) {
+		_idle_gpu_ms = _idle_gpu_ms < 0.0 ? gpu_ms : _idle_gpu_ms * 0.9 + gpu_ms * 0.1;
+	} else if (_idle_gpu_ms >= 0.0 && gpu_ms > 0.0) {
+		double spent_ms = std::max(gpu_ms - _idle_gpu_ms, 0.01);
+		double scale = std::min(std::max(_budget_ms / spent_ms, 0.5), 2.0);
+		_units_per_frame = _units_last_frame * scale;
+	}
+
+	if (!busy()) {
+		return false;
+	}
+
+	// the conversion takes a frame of its own. Its mips have to be there for the prefilter passes
+	if (bgfx::isValid(_equirect)) {
+		_cube_tex = equirect_to_cube(_equirect, _src_res, &_baker);
+		bgfx::destroy(_equirect);
+		_equirect = BGFX_INVALID_HANDLE;
+		_units_last_frame = 6.0 * _src_res * _src_res;
+		return false;
+	}
+
+	// the last passes went out with the previous frame, anything submitted from now on comes after
+	if (_next == _jobs.size()) {
+		_units_last_frame = 0.0;
+		return true;
+	}
+
+	double spent = 0.0;
+	while (_next < _jobs.size() && _baker.capacity() > 0) {
+		const Job& job = _jobs[_next];
+		// at least one pass per frame, or a tiny budget would never finish
+		if (spent > 0.0 && spent + job.cost > _units_per_frame) {
+			break;
+		}
+
+		glm::vec4 mip_roughness = glm::vec4((float)job.mip / (float)(_mip_levels - 1),
+											(float)_src_res,
+											(float)(job.mip + 1),
+											0.0f);
+		std::vector<UniformContext> ucs = {{_baker.u_roughness, &mip_roughness, 1}};
+		_baker.submit_face(_prefilter,
+							job.mip,
+							job.side,
+							_cube_tex,
+							_res >> job.mip,
+							_baker.prefilter_prog(),
+							ucs,
+							job.tile_y,
+							job.tile_height);
+		spent += job.cost;
+		++_next;
+	}
+	_units_last_frame = spent;
+	return false;
+}
+
+void IncrementalBaker::take(bgfx::TextureHandle& cube_tex, bgfx::TextureHandle& prefilter) {
+	cube_tex = _cube_tex;
+	prefilter = _prefilter;
+	_cube_tex = BGFX_INVALID_HANDLE;
+	_prefilter = BGFX_INVALID_HANDLE;
+	_jobs.clear();
+	_next = 0;
+}
+
+BakeCache::BakeCache(const std::string& dir, uint32_t src_hash)
+	: _dir(dir),
+	  _src_hash(src_hash),
+	  // recompiled bake shaders invalidate their entries
+	  _irradiance_shaders_hash(io::hash_assets({skybox_vs_path, irradiance_fs_path})),
+	  _prefilter_shaders_hash(io::hash_assets({skybox_vs_path, prefilter_fs_path})) {}
+
+std::string BakeCache::entry_path(const char* kind,
+									int res,
+									int mips,
+									bool with_src,
+									uint32_t shaders_hash) const {
+	bx::HashMurmur2A hash;
+	hash.begin();
+	hash.add(bake_cache_version);
+	if (with_src) {
+		hash.add(_src_hash);
+	}
+	hash.add(res);
+	hash.add(mips);
+	hash.add(shaders_hash);
+
+	std::stringstream ss;
+	ss << _dir << "/" << kind << "_" << std::hex << hash.end() << ".ktx";
+	return ss.str();
+}
+
+namespace {
+
+bgfx::TextureHandle load_cached(const std::string& path) {
+	if (!std::ifstream(path).good()) {
+		return BGFX_INVALID_HANDLE;
+	}
+	return io::load_texture(path, BGFX_SAMPLER_UVW_CLAMP);
+}
+
+}
+
+bgfx::TextureHandle BakeCache::irradiance_map(bgfx::TextureHandle cube_tex,
+												int res,
+												CubeBaker* baker) {
+	std::string path = entry_path("irradiance", res, 1, true, _irradiance_shaders_hash);
+	bgfx::TextureHandle hdl = load_cached(path);
+	if (!bgfx::isValid(hdl)) {
+		hdl = gen_irradiance_map(cube_tex, res, baker);
+		_misses.push_back({hdl, path, res, 1, true, bgfx::TextureFormat::RGBA16F});
+	}
+	return hdl;
+}
+
+bgfx::TextureHandle BakeCache::prefilter_map(bgfx::TextureHandle cube_tex,
+												int src_res,
+												int res,
+												int mip_levels,
+												CubeBaker* baker) {
+	std::string path = entry_path("prefilter", res, mip_levels, true, _prefilter_shaders_hash);
+	bgfx::TextureHandle hdl = load_cached(path);
+	if (!bgfx::isValid(hdl)) {
+		hdl = gen_prefilter_map(cube_tex, src_res, res, mip_levels, baker);
+		_misses.push_back({hdl, path, res, mip_levels, true, bgfx::TextureFormat::RGBA16F});
+	}
+	return hdl;
+}
+
+bool BakeCache::has_prefilter_map(int res, int mip_levels) const {
+	return std::ifstream(entry_path("prefilter", res, mip_levels, true, _prefilter_shaders_hash)).good();
+}
+
+void BakeCache::store() {
+	if (_misses.empty()) {
+		return;
+	}
+
+	const bgfx::Caps* caps = bgfx::getCaps();
+	if (!(caps->supported & BGFX_CAPS_TEXTURE_BLIT) ||
+		!(caps->supported & BGFX_CAPS_TEXTURE_READ_BACK)) {
+		std::cout << "Texture read back not supported, bakes are not cached" << std::endl;
+		_misses.clear();
+		return;
+	}
+	mkdir(_dir.c_str(), 0755);
+
+	// render targets cannot be read back directly.
+	// Copy every face and mip to a staging texture and read that
+	std::vector<bimg::ImageContainer*> images;
+	std::vector<bgfx::TextureHandle> staging;
+	uint32_t ready = 0;
+	for (const Entry& e : _misses) {
+		bimg::ImageContainer* image = bimg::imageAlloc(&mem::default_allocator(),
+														bimg::TextureFormat::Enum(e.format),
+														uint16_t(e.res),
+														uint16_t(e.res),
 														1,
-														bgfx::TextureFormat::RG16F,
-														// clamp border.
-														// Since dot(n, v) in fresnel calculations could be a little over 1.0f,
-														// wrap back to 0.0f will result in small bright circle in the middle.
-														// Document this
-														BGFX_TEXTURE_RT | BGFX_SAMPLER_UVW_CLAMP);
-	
-	bgfx::FrameBufferHandle fb = bgfx::createFrameBuffer(1, &tex_lut, false);
-
-	bgfx::setViewClear(0, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, 0x101010ff, 1.0f);
-	bgfx::setViewRect(0, 0, 0, res, res);
-	bgfx::setViewFrameBuffer(0, fb);	
-	bgfx::setState(BGFX_STATE_WRITE_RGB |
-                	BGFX_STATE_WRITE_A | 
-                	BGFX_STATE_DEPTH_TEST_ALWAYS);
-	bgfx::setVertexBuffer(0, vb_hdl);
-	bgfx::submit(0, prog);
-	bgfx::frame();
-
-	// todo: destroy stuff
-	bgfx::destroy(fb);
-	bgfx::destroy(prog);
-	bgfx::destroy(vb_hdl);
-
-	return tex_lut;
-}
-
-}
\ No newline at end of file
+														1,
+														e.cube,
+														e.mips > 1);
+		// only the baked levels, the rest of the chain is never written
+		image->m_numMips = uint8_t(e.mips);
+
+		int sides = e.cube ? 6 : 1;
+		for (int side = 0; side < sides; ++side) {
+			for (int m = 0; m < e.mips; ++m) {
+				bimg::ImageMip mip;
+				bimg::imageGetRawData(*image, uint16_t(side), uint8_t(m), image->m_data, image->m_size, mip);
+
+				uint16_t mip_res = uint16_t(e.res >> m);
+				bgfx::TextureHandle tex = bgfx::createTexture2D(mip_res,
+																mip_res,
+																false,
+																1,
+																e.format,
+																BGFX_TEXTURE_BLIT_DST | BGFX_TEXTURE_READ_BACK);
+				bgfx::blit(bake_blit_view, tex, 0, 0, 0, 0, e.tex, uint8_t(m), 0, 0, uint16_t(side), mip_res, mip_res);
+				ready = bgfx::readTexture(tex, const_cast<uint8_t*>(mip.m_data));
+				staging.push_back(tex);
+			}
+		}
+		images.push_back(image);
+	}
+
+	// read backs are done by the end of frame 'ready'
+	while (bgfx::frame() < ready) {}
+
+	for (size_t i = 0; i < images.size(); ++i) {
+		bx::FileWriter writer;
+		bx::Error err;
+		if (bx::open(&writer, _misses[i].path.c_str(), false, &err)) {
+			bimg::imageWriteKtx(&writer, *images[i], images[i]->m_data, images[i]->m_size, &err);
+			bx::close(&writer);
+		}
+		if (!err.isOk()) {
+			std::cout << "Cannot write bake cache " << _misses[i].path << ", ";
+			std::cout << err.getMessage().getPtr() << std::endl;
+		}
+		bimg::imageFree(images[i]);
+	}
+	for (bgfx::TextureHandle tex : staging) {
+		bgfx::destroy(tex);
+	}
+	_misses.clear();
+}
+
+namespace {
+
+struct SH9Face {
+	std::vector<float> rgba; // RGBA32F
+	uint32_t size;
+};
+
+SH9Face convert_face(const bimg::ImageContainer& image, uint16_t side) {
+	bimg::ImageMip mip;
+	bimg::imageGetRawData(image, side, 0, image.m_data, image.m_size, mip);
+
+	SH9Face face;
+	face.size = mip.m_width;
+	face.rgba.resize(size_t(mip.m_width) * mip.m_height * 4);
+	mem::ScratchScope scratch;
+	bimg::imageConvert(scratch.allocator(),
+						face.rgba.data(),
+						bimg::TextureFormat::RGBA32F,
+						mip.m_data,
+						mip.m_format,
+						mip.m_width,
+						mip.m_height,
+						1);
+	return face;
+}
+
+// direction through (s, t) in [-1, 1] of a face, following the GL cube map conventions.
+// t goes down the rows of the image
+glm::vec3 face_dir(int side, float s, float t) {
+	switch (side) {
+	case 0:  return glm::vec3( 1.0f,    -t,    -s);
+	case 1:  return glm::vec3(-1.0f,    -t,     s);
+	case 2:  return glm::vec3(    s,  1.0f,     t);
+	case 3:  return glm::vec3(    s, -1.0f,    -t);
+	case 4:  return glm::vec3(    s,    -t,  1.0f);
+	default: return glm::vec3(   -s,    -t, -1.0f);
+	}
+}
+
+// per worker sums. 9 rgb coefficients and the total solid angle
+const int sh9_sum_count = 9 * 3 + 1;
+typedef std::array<double, sh9_sum_count> SH9Sum;
+
+// n normalized
+inline void add_sh9(SH9Sum& sum, const float* rgb, float nx, float ny, float nz, float d_omega) {
+	float basis[9] = {
+		0.282095f,
+		0.488603f * ny,
+		0.488603f * nz,
+		0.488603f * nx,
+		1.092548f * nx * ny,
+		1.092548f * ny * nz,
+		0.315392f * (3.0f * nz * nz - 1.0f),
+		1.092548f * nx * nz,
+		0.546274f * (nx * nx - ny * ny),
+	};
+	for (int i = 0; i < 9; ++i) {
+		float w = basis[i] * d_omega;
+		sum[i * 3 + 0] += rgb[0] * w;
+		sum[i * 3 + 1] += rgb[1] * w;
+		sum[i * 3 + 2] += rgb[2] * w;
+	}
+	sum[sh9_sum_count - 1] += d_omega;
+}
+
+SH9 finish_sh9(const std::vector<SH9Sum>& partials) {
+	SH9Sum total;
+	total.fill(0.0);
+	for (auto& p : partials) {
+		for (int i = 0; i < sh9_sum_count; ++i) {
+			total[i] += p[i];
+		}
+	}
+
+	// the texel solid angles are approximated, renormalize to the full sphere.
+	// Then fold in the cosine lobe convolution over pi (1, 2/3, 1/4 per band)
+	// and the basis constants, leaving only the polynomials to the shader
+	const double norm = 4.0 * M_PI / total[sh9_sum_count - 1];
+	const double factors[9] = {
+		0.282095 * 1.0,
+		0.488603 * 2.0 / 3.0,
+		0.488603 * 2.0 / 3.0,
+		0.488603 * 2.0 / 3.0,
+		1.092548 * 0.25,
+		1.092548 * 0.25,
+		0.315392 * 0.25,
+		1.092548 * 0.25,
+		0.546274 * 0.25,
+	};
+	SH9 sh;
+	for (int i = 0; i < 9; ++i) {
+		double f = factors[i] * norm;
+		sh[i] = glm::vec4(float(total[i * 3 + 0] * f),
+							float(total[i * 3 + 1] * f),
+							float(total[i * 3 + 2] * f),
+							0.0f);
+	}
+	return sh;
+}
+
+SH9 project_sh9_faces(const std::array<SH9Face, 6>& faces) {
+	const uint32_t size = faces[0].size;
+	const size_t rows = 6 * size_t(size);
+
+	std::vector<SH9Sum> partials(par::worker_count());
+	for (auto& p : partials) {
+		p.fill(0.0);
+	}
+
+	par::parallel_for(rows, [&](size_t begin, size_t end, unsigned worker) {
+		SH9Sum& sum = partials[worker];
+		for (size_t row = begin; row < end; ++row) {
+			int side = int(row / size);
+			uint32_t y = uint32_t(row % size);
+			const float* texel = faces[side].rgba.data() + size_t(y) * size * 4;
+			float t = (2.0f * (float(y) + 0.5f) / float(size)) - 1.0f;
+			for (uint32_t x = 0; x < size; ++x, texel += 4) {
+				float s = (2.0f * (float(x) + 0.5f) / float(size)) - 1.0f;
+				glm::vec3 d = face_dir(side, s, t);
+				float len2 = s * s + t * t + 1.0f;
+				// solid angle subtended by the texel
+				float d_omega = 4.0f / (float(size) * float(size) * len2 * std::sqrt(len2));
+				float inv_len = 1.0f / std::sqrt(len2);
+				add_sh9(sum, texel, d.x * inv_len, d.y * inv_len, d.z * inv_len, d_omega);
+			}
+		}
+	});
+
+	return finish_sh9(partials);
+}
+
+}
+
+SH9 project_sh9(const std::array<bimg::ImageContainer*, 6>& faces) {
+	std::array<SH9Face, 6> converted;
+	for (int i = 0; i < 6; ++i) {
+		converted[i] = convert_face(*faces[i], 0);
+	}
+	return project_sh9_faces(converted);
+}
+
+SH9 project_sh9(const bimg::ImageContainer& cube) {
+	assert(cube.m_cubeMap);
+	std::array<SH9Face, 6> converted;
+	for (int i = 0; i < 6; ++i) {
+		converted[i] = convert_face(cube, uint16_t(i));
+	}
+	return project_sh9_faces(converted);
+}
+
+SH9 project_sh9_equirect(const bimg::ImageContainer& image) {
+	SH9Face map = convert_face(image, 0);
+	const uint32_t width = image.m_width;
+	const uint32_t height = image.m_height;
+
+	std::vector<SH9Sum> partials(par::worker_count());
+	for (auto& p : partials) {
+		p.fill(0.0);
+	}
+
+	// same mapping as equirect_to_cube_fs
+	par::parallel_for(height, [&](size_t begin, size_t end, unsigned worker) {
+		SH9Sum& sum = partials[worker];
+		for (size_t y = begin; y < end; ++y) {
+			const float* texel = map.rgba.data() + y * width * 4;
+			float lat = (0.5f - (float(y) + 0.5f) / float(height)) * float(M_PI);
+			float cos_lat = std::cos(lat);
+			float ny = std::sin(lat);
+			// rows shrink towards the poles
+			float d_omega = cos_lat * (2.0f * float(M_PI) / float(width)) * (float(M_PI) / float(height));
+			for (uint32_t x = 0; x < width; ++x, texel += 4) {
+				float lon = ((float(x) + 0.5f) / float(width) - 0.5f) * 2.0f * float(M_PI);
+				add_sh9(sum, texel, std::cos(lon) * cos_lat, ny, std::sin(lon) * cos_lat, d_omega);
+			}
+		}
+	});
+
+	return finish_sh9(partials);
+}
+
+}
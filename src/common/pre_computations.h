@@ -1,8 +1,14 @@
 #pragma once
 
+#include <array>
+#include <string>
 #include <vector>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
 
 #include "bgfx/bgfx.h"
+#include "bimg/bimg.h"
+#include "programs.h"
 
 namespace pcp {
 
@@ -12,23 +18,232 @@ struct UniformContext {
 	uint16_t num;
 };
 
+// view matrix of a camera at the origin looking through face side of a cube map,
+// following the GL cube map conventions
+const glm::mat4& cube_face_view(int side);
+
+// Records cube map convolutions into a reserved range of views,
+// so that a whole bake is kicked off by a single bgfx::frame().
+// Every face is rendered in its own view, straight into its layer and mip of the destination,
+// which has to be created with BGFX_TEXTURE_RT. Nothing is executed before flush()
+class CubeBaker {
+public:
+	CubeBaker();
+	// with its own range of views, for bakers recording in the same frame
+	CubeBaker(bgfx::ViewId first_view, uint16_t view_count);
+	~CubeBaker();
+
+	// render cube_tex through prog, onto face side of dst at mip level dst_mip.
+	// tile_height > 0 limits the pass to rows [tile_y, tile_y + tile_height) of the face
+	void submit_face(bgfx::TextureHandle dst,
+						int dst_mip,
+						int side,
+						bgfx::TextureHandle cube_tex,
+						int res,
+						bgfx::ProgramHandle prog,
+						const std::vector<UniformContext>& ucs,
+						int tile_y = 0,
+						int tile_height = 0,
+						uint8_t resolve = BGFX_RESOLVE_NONE);
+
+	// all six faces
+	void submit_cube(bgfx::TextureHandle dst,
+						int dst_mip,
+						bgfx::TextureHandle cube_tex,
+						int res,
+						bgfx::ProgramHandle prog,
+						const std::vector<UniformContext>& ucs);
+
+	// number of faces that can still be recorded before a flush is needed
+	int capacity() const;
+
+	// submit everything recorded so far in one frame. Returns the frame number
+	uint32_t flush();
+
+	// for passes kicked off by someone else's bgfx::frame(). Call after that frame
+	// to free the views and frame buffers of the recorded passes
+	void release();
+
+	// current programs, resolve again every frame. See io::ProgramRegistry
+	bgfx::ProgramHandle irradiance_prog();
+
+	bgfx::ProgramHandle prefilter_prog();
+
+	bgfx::ProgramHandle equirect_prog();
+
+	// sample table of prefilter_fs for mip_levels roughness levels, see gen_sample_table.
+	// Bound to stage 1 of every pass recorded from then on
+	bgfx::TextureHandle prefilter_samples(int mip_levels);
+
+	bgfx::UniformHandle u_roughness;
+
+private:
+	bgfx::ViewId _first_view;
+	uint16_t _view_count;
+	bgfx::VertexBufferHandle _cube_vb;
+	bgfx::UniformHandle _s_env;
+	bgfx::UniformHandle _s_samples;
+	bgfx::TextureHandle _samples;
+	int _sample_levels;
+	// through io::programs(), reloaded along with the shaders
+	io::ProgramId _irradiance_prog;
+	io::ProgramId _prefilter_prog;
+	io::ProgramId _equirect_prog;
+	// one per recorded face, attached to the face and mip it renders to
+	std::vector<bgfx::FrameBufferHandle> _faces;
+};
+
 bgfx::TextureHandle convolute_cube_map(bgfx::TextureHandle cube_tex,
 										int res,
 										bgfx::ProgramHandle prog,
 										std::vector<UniformContext> ucs);
 
+// With a baker, the passes are only recorded. Call baker->flush() before using the texture.
+// Without one, the passes are submitted right away
+bgfx::TextureHandle gen_irradiance_map(bgfx::TextureHandle cube_tex,
+										int res,
+										CubeBaker* baker = nullptr);
 
-bgfx::TextureHandle gen_irradiance_map(bgfx::TextureHandle cube_tex, int res);
-
-void blit_cube_map(bgfx::TextureHandle dst,
-					int dst_mip,
-					bgfx::TextureHandle src,
-					int src_mip);
-
+// src_res: face resolution of cube_tex. It should come with a full mip chain,
+// the samples pick their source mip from it
 bgfx::TextureHandle gen_prefilter_map(bgfx::TextureHandle cube_tex,
+										int src_res,
 										int res,
-										int mip_levels);
+										int mip_levels,
+										CubeBaker* baker = nullptr);
 
+// split-sum BRDF lut, RG16F. Integrated on the cpu like brdf_lut_gen does at build time, see brdf_lut.h.
+// For when the build's brdf_lut.ktx is missing
 bgfx::TextureHandle gen_brdf_lut(int res);
 
-}
\ No newline at end of file
+// Hammersley points and GGX half vectors for the bake shaders, generated once on the cpu
+// instead of per texel. RGBA32F, one column per sample, point sampled.
+// Row 0: (cos, sin) of the azimuth 2 pi i / sample_count, and the radical inverse of i.
+// Row 1 + k: tangent space half vector for roughness k / (roughness_levels - 1) in xyz,
+// and its pdf around n = v, D / 4, in w
+bgfx::TextureHandle gen_sample_table(int sample_count, int roughness_levels);
+
+// projects a 2D equirectangular map, e.g. from io::load_texture_equirect, into a RGBA16F cube map
+// of face resolution res, with a full mip chain
+bgfx::TextureHandle equirect_to_cube(bgfx::TextureHandle equirect,
+										int res,
+										CubeBaker* baker = nullptr);
+
+// Re-bakes the prefilter map of a new environment alongside regular frames.
+// The work is cut into bands of rows of every face and mip, and each frame records
+// as many of them as fit in a gpu time budget, measured from the frame timings.
+// The maps in use stay valid until the whole new set is done
+class IncrementalBaker {
+public:
+	IncrementalBaker(float budget_ms = 2.0f, int tile_rows = 32);
+	~IncrementalBaker();
+
+	// takes ownership of cube_tex. Drops the bake in progress, if any
+	void start(bgfx::TextureHandle cube_tex, int src_res, int res, int mip_levels);
+
+	// same, from an equirectangular map. Converted to a cube of face resolution cube_res first
+	void start_equirect(bgfx::TextureHandle equirect, int cube_res, int res, int mip_levels);
+
+	// records this frame's share of passes. Call once per frame, before bgfx::frame()
+	// Returns true once the new set has been rendered and can be taken
+	bool update();
+
+	bool busy() const;
+
+	// hands over the environment passed to start() and its prefilter map
+	void take(bgfx::TextureHandle& cube_tex, bgfx::TextureHandle& prefilter);
+
+private:
+	struct Job {
+		int mip;
+		int side;
+		int tile_y;
+		int tile_height;
+		double cost; // texels * samples
+	};
+
+	void drop();
+
+	CubeBaker _baker;
+	float _budget_ms;
+	int _tile_rows;
+
+	bgfx::TextureHandle _equirect;
+	bgfx::TextureHandle _cube_tex;
+	bgfx::TextureHandle _prefilter;
+	int _src_res;
+	int _res;
+	int _mip_levels;
+	std::vector<Job> _jobs;
+	size_t _next;
+
+	// cost units recorded per frame, adapted from the measured gpu time
+	double _units_per_frame;
+	double _units_last_frame;
+	double _idle_gpu_ms;
+};
+
+// On-disk cache of baked textures. Entries are .ktx files under dir, keyed on
+// the content hash of the source, see io::hash_assets, the bake parameters and the bake shader binaries.
+// The shaders are hashed once, here. A cache miss bakes the texture as usual and remembers it for store()
+class BakeCache {
+public:
+	BakeCache(const std::string& dir, uint32_t src_hash);
+
+	bgfx::TextureHandle irradiance_map(bgfx::TextureHandle cube_tex,
+										int res,
+										CubeBaker* baker = nullptr);
+
+	bgfx::TextureHandle prefilter_map(bgfx::TextureHandle cube_tex,
+										int src_res,
+										int res,
+										int mip_levels,
+										CubeBaker* baker = nullptr);
+
+	// whether prefilter_map() with these parameters is a cache hit, and leaves cube_tex alone
+	bool has_prefilter_map(int res, int mip_levels) const;
+
+	// read back every texture baked since the last store() and write it to disk.
+	// Passes recorded into a baker have to be flushed before.
+	// Blocks for the couple of frames the read back takes
+	void store();
+
+private:
+	struct Entry {
+		bgfx::TextureHandle tex;
+		std::string path;
+		int res;
+		int mips;
+		bool cube;
+		bgfx::TextureFormat::Enum format;
+	};
+
+	std::string entry_path(const char* kind,
+							int res,
+							int mips,
+							bool with_src,
+							uint32_t shaders_hash) const;
+
+	std::string _dir;
+	uint32_t _src_hash;
+	uint32_t _irradiance_shaders_hash;
+	uint32_t _prefilter_shaders_hash;
+	std::vector<Entry> _misses;
+};
+
+// Irradiance of an environment as 9 spherical harmonics coefficients, rgb in xyz.
+// Already convolved with the cosine lobe and divided by pi, so evaluating it
+// gives the same value as sampling the map from gen_irradiance_map
+typedef std::array<glm::vec4, 9> SH9;
+
+// projected on the cpu, spread across all cores.
+// Faces in +x, -x, +y, -y, +z, -z order. Any format bimg can convert to RGBA32F
+SH9 project_sh9(const std::array<bimg::ImageContainer*, 6>& faces);
+
+// for a single cube map image, e.g. a .ktx
+SH9 project_sh9(const bimg::ImageContainer& cube);
+
+// for an equirectangular map, see io::load_image_equirect
+SH9 project_sh9_equirect(const bimg::ImageContainer& image);
+
+}
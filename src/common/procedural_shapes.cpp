@@ -1,137 +1,255 @@
 #include "procedural_shapes.h"
+#include "half.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
 #include <glm/gtx/quaternion.hpp>
+#include <cassert>
 #include <set>
+#include <unordered_map>
 #include <cstdio>
+#include <iostream>
+#include <limits>
 
-void ProceduralShapes::gen_ico_sphere(std::vector<float>& vb,
-                                      std::vector<uint16_t>& ib,
-                                      VertexAttrib attrib,
+const void* ProceduralShapes::Indices::data() const {
+    return index32 ? (const void*)u32.data() : (const void*)u16.data();
+}
+
+uint32_t ProceduralShapes::Indices::bytes() const {
+    return uint32_t(index32 ? u32.size() * sizeof(uint32_t) : u16.size() * sizeof(uint16_t));
+}
+
+size_t ProceduralShapes::Indices::count() const {
+    return index32 ? u32.size() : u16.size();
+}
+
+void ProceduralShapes::Indices::fit(size_t vertex_count) {
+    index32 = vertex_count > 0x10000;
+    u16.clear();
+    if (!index32) {
+        u16.assign(u32.begin(), u32.end());
+        u32.clear();
+    }
+}
+
+template <typename Index>
+void ProceduralShapes::copy_indices(const IndexBuffer& src, size_t vertex_count, IndexType i_type, std::vector<Index>& dst) {
+    dst.clear();
+    if (vertex_count == 0) {
+        // nothing to index
+        return;
+    }
+    if (vertex_count - 1 > std::numeric_limits<Index>::max()) {
+        std::cout << "Cannot index " << vertex_count << " vertices with " << sizeof(Index) * 8 << " bit indices" << std::endl;
+        return;
+    }
+
+    if (i_type == IndexType::LINE) {
+        tri2line(src, dst);
+    } else if (i_type == IndexType::TRIANGLE) {
+        dst.reserve(src.size() * 3);
+        for (auto& i : src) {
+            dst.insert(dst.end(), { Index(i.x), Index(i.y), Index(i.z) });
+        }
+    } else {
+        assert(false);
+    }
+}
+
+template <typename V, typename Index>
+void ProceduralShapes::gen_ico_sphere(std::vector<V>& vb,
+                                      std::vector<Index>& ib,
                                       float r,
                                       int lod,
-                                      IndexType i_type) {
-    PositionBuffer vec3_pb;
-    NormalBuffer vec3_nb;
-    UVBuffer vec2_uv;
-    TangentBuffer vec3_tb;
-    IndexBuffer vec3_ib;
-    
-    //generate position buffer and index buffer
-    init_icosphere(r, vec3_pb, vec3_ib);
-    for(int i = 0; i < lod; ++i) {
-        add_icosphere_lod(r, vec3_pb, vec3_ib);
+                                      IndexType i_type,
+                                      mesh::Report* report) {
+    IndexBuffer triangles;
+    ico_sphere(vb, triangles, r, lod, report);
+    copy_indices(triangles, vb.size(), i_type, ib);
+}
+
+template <typename V>
+void ProceduralShapes::gen_ico_sphere(std::vector<V>& vb,
+                                      Indices& ib,
+                                      float r,
+                                      int lod,
+                                      IndexType i_type,
+                                      mesh::Report* report) {
+    gen_ico_sphere(vb, ib.u32, r, lod, i_type, report);
+    ib.fit(vb.size());
+}
+
+#define INSTANTIATE_ICO_SPHERE(V) \
+    template void ProceduralShapes::gen_ico_sphere<V, uint16_t>(std::vector<V>&, std::vector<uint16_t>&, float, int, IndexType, mesh::Report*); \
+    template void ProceduralShapes::gen_ico_sphere<V, uint32_t>(std::vector<V>&, std::vector<uint32_t>&, float, int, IndexType, mesh::Report*); \
+    template void ProceduralShapes::gen_ico_sphere<V>(std::vector<V>&, Indices&, float, int, IndexType, mesh::Report*);
+
+INSTANTIATE_ICO_SPHERE(ProceduralShapes::Vertex<ProceduralShapes::POS>)
+INSTANTIATE_ICO_SPHERE(ProceduralShapes::Vertex<ProceduralShapes::POS_NORM>)
+INSTANTIATE_ICO_SPHERE(ProceduralShapes::Vertex<ProceduralShapes::POS_NORM_UV>)
+INSTANTIATE_ICO_SPHERE(ProceduralShapes::Vertex<ProceduralShapes::POS_NORM_UV_TANGENT>)
+INSTANTIATE_ICO_SPHERE(ProceduralShapes::QuantizedVertex)
+
+#undef INSTANTIATE_ICO_SPHERE
+
+namespace {
+
+// 4x repeated on u, 2x repeated on v
+const float uv_repeat_u = 4.0f;
+const float uv_repeat_v = 2.0f;
+
+// one attribute of an interleaved vertex, at a byte offset
+template <typename T, typename Vertex>
+T get_attrib(const Vertex& v, size_t offset) {
+    T value;
+    memcpy(&value, reinterpret_cast<const uint8_t*>(&v) + offset, sizeof(T));
+    return value;
+}
+
+template <typename T, typename Vertex>
+void set_attrib(Vertex& v, size_t offset, const T& value) {
+    memcpy(reinterpret_cast<uint8_t*>(&v) + offset, &value, sizeof(T));
+}
+
+int16_t to_snorm16(float v) {
+    return int16_t(std::round(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f));
+}
+
+// unit vector onto the octahedron, its lower half folded over the upper one
+void to_octahedral(const glm::vec3& v, int16_t out[2]) {
+    float l1 = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    float x = v.x / l1;
+    float y = v.y / l1;
+    if (v.z < 0.0f) {
+        float folded_x = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float folded_y = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
     }
+    out[0] = to_snorm16(x);
+    out[1] = to_snorm16(y);
+}
 
-    if (attrib & VertexAttrib::NORM) {
-        //generate normal buffer
-        for(const glm::vec3& p : vec3_pb) {
-            vec3_nb.push_back(glm::normalize(p));
-        }
+}
+
+template <int Attribs>
+void ProceduralShapes::ico_sphere(std::vector<Vertex<Attribs>>& vb, IndexBuffer& ib, float r, int lod, mesh::Report* report) {
+    typedef Vertex<Attribs> V;
+    static_assert(!(Attribs & TANGENT) || (Attribs & UV), "tangents follow the uvs");
+
+    //generate position buffer and index buffer. The subdivision works on positions only
+    PositionBuffer pb;
+    init_icosphere(r, pb, ib);
+    for(int i = 0; i < lod; ++i) {
+        add_icosphere_lod(r, pb, ib);
     }
 
-    if (attrib & VertexAttrib::UV) {
-        // generate uv buffer
-        for (const glm::vec3& p : vec3_pb) {
+    vb.resize(pb.size());
+    for (size_t i = 0; i < pb.size(); ++i) {
+        const glm::vec3& p = pb[i];
+        set_attrib(vb[i], V::position_offset, p);
+        if (Attribs & NORM) {
+            set_attrib(vb[i], V::normal_offset, glm::normalize(p));
+        }
+        if (Attribs & UV) {
             float u = std::atan2(p.y, p.x) * M_1_PI * 0.5 + 0.5;
             float v = std::asin(p.z / r) * M_1_PI + 0.5;
-            vec2_uv.push_back(glm::vec2(u, v));
+            set_attrib(vb[i], V::uv_offset, glm::vec2(u * uv_repeat_u, v * uv_repeat_v));
         }
+    }
+
+    if (Attribs & UV) {
+        auto position = [&](uint32_t idx) { return get_attrib<glm::vec3>(vb[idx], V::position_offset); };
+        // a copy of vertex idx with another u
+        auto copy_vertex = [&](uint32_t idx, float u) {
+            V copy = vb[idx];
+            glm::vec2 uv = get_attrib<glm::vec2>(copy, V::uv_offset);
+            set_attrib(copy, V::uv_offset, glm::vec2(u, uv.y));
+            vb.push_back(copy);
+            return uint32_t(vb.size() - 1);
+        };
 
         // eliminate seam
-        // TODO: seam points redundant
-        for (glm::u16vec3& i : vec3_ib) {
+        // vertices are shared, so is their copy on the other side of the seam. Keyed on the original index
+        std::unordered_map<uint32_t, uint32_t> seam_plus;
+        std::unordered_map<uint32_t, uint32_t> seam_minus;
+        auto seam_copy = [&](std::unordered_map<uint32_t, uint32_t>& copies, uint32_t idx, float u_shift) {
+            auto it = copies.find(idx);
+            if (it != copies.end()) {
+                return it->second;
+            }
+            uint32_t copy = copy_vertex(idx, get_attrib<glm::vec2>(vb[idx], V::uv_offset).x + u_shift);
+            copies.emplace(idx, copy);
+            return copy;
+        };
+        for (u32vec3& i : ib) {
             // check AABB of individual triangle
             float y_min = std::numeric_limits<float>::max();
             float y_max = -std::numeric_limits<float>::max();
-            uint16_t* i_ptr = (uint16_t*)&i;
-            for (int offset = 0; offset < 3; ++offset, ++i_ptr) {
-                glm::vec3& p = vec3_pb[*i_ptr];
+            for (int k = 0; k < 3; ++k) {
+                glm::vec3 p = position(i[k]);
                 y_min = glm::min(p.y, y_min);
                 y_max = glm::max(p.y, y_max);
             }
 
+            // the normals' x, straight from the positions
+            float x_mean = (glm::normalize(position(i.x)).x
+                            + glm::normalize(position(i.y)).x
+                            + glm::normalize(position(i.z)).x) / 3;
+
             if (y_min < 0.0f && y_max > 0.0f) {
                 // this triangle intersects y = 0 plane
-                float x_mean = (vec3_nb[i.x].x + vec3_nb[i.y].x + vec3_nb[i.z].x) / 3;
                 if (x_mean < 0.0f) {
                     // this triangle is facing -x direction. So crossing the seam
-                    i_ptr = (uint16_t*)&i;
-                    for (int offset = 0; offset < 3; ++offset, ++i_ptr) {
-                        glm::vec3& p = vec3_pb[*i_ptr];
-                        glm::vec3& n = vec3_nb[*i_ptr];
-                        glm::vec2& uv = vec2_uv[*i_ptr];
+                    for (int k = 0; k < 3; ++k) {
+                        glm::vec3 p = position(i[k]);
                         if (p.y < 0.0f && p.z != r && p.z != -r) {
                             // leave out the top and bottom point
-                            vec3_pb.push_back(p);
-                            vec3_nb.push_back(n);
-                            vec2_uv.emplace_back(uv.x + 1.0f, uv.y);
-                            *i_ptr = vec3_pb.size() - 1;
+                            i[k] = seam_copy(seam_plus, i[k], uv_repeat_u);
                         }
                     }
                 }
             }
 
             if (y_max == 0.0f) {
-                float x_mean = (vec3_nb[i.x].x + vec3_nb[i.y].x + vec3_nb[i.z].x) / 3;
                 if (x_mean < 0.0f) {
-                    i_ptr = (uint16_t*)&i;
-                    for (int offset = 0; offset < 3; ++offset, ++i_ptr) {
-                        glm::vec3& p = vec3_pb[*i_ptr];
-                        glm::vec3& n = vec3_nb[*i_ptr];
-                        glm::vec2& uv = vec2_uv[*i_ptr];
+                    for (int k = 0; k < 3; ++k) {
+                        glm::vec3 p = position(i[k]);
                         if (p.y == 0.0f && p.z != r && p.z != -r) {
                             // leave out the top and bottom point
-                            vec3_pb.push_back(p);
-                            vec3_nb.push_back(n);
-                            vec2_uv.emplace_back(uv.x - 1.0f, uv.y);
-                            *i_ptr = vec3_pb.size() - 1;
+                            i[k] = seam_copy(seam_minus, i[k], -uv_repeat_u);
                         }
                     }
                 }
             }
         }
 
-        // rearrange top and bottom point
-        for (glm::u16vec3& i : vec3_ib) {
-            glm::vec3& p0 = vec3_pb[i.x];
-            glm::vec3& p1 = vec3_pb[i.y];
-            glm::vec3& p2 = vec3_pb[i.z];
-            glm::vec2& uv0 = vec2_uv[i.x];
-            glm::vec2& uv1 = vec2_uv[i.y];
-            glm::vec2& uv2 = vec2_uv[i.z];
-
-            if (p0.z == r || p0.z == -r) {
-                vec3_pb.push_back(p0);
-                vec3_nb.push_back(vec3_nb[i.x]);
-                vec2_uv.emplace_back((uv1.x + uv2.x) / 2, uv0.y);
-                i.x = vec3_pb.size() - 1;
-            } else if (p1.z == r || p1.z == -r) {
-                vec3_pb.push_back(p1);
-                vec3_nb.push_back(vec3_nb[i.y]);
-                vec2_uv.emplace_back((uv0.x + uv2.x) / 2, uv1.y);
-                i.y = vec3_pb.size() - 1;
-            } else if (p2.z == r || p2.z == -r) {
-                vec3_pb.push_back(p2);
-                vec3_nb.push_back(vec3_nb[i.z]);
-                vec2_uv.emplace_back((uv0.x + uv1.x) / 2, uv2.y);
-                i.z = vec3_pb.size() - 1;
+        // rearrange top and bottom point, a copy per triangle with u halfway between the other two
+        for (u32vec3& i : ib) {
+            for (int k = 0; k < 3; ++k) {
+                float z = position(i[k]).z;
+                if (z == r || z == -r) {
+                    float u1 = get_attrib<glm::vec2>(vb[i[(k + 1) % 3]], V::uv_offset).x;
+                    float u2 = get_attrib<glm::vec2>(vb[i[(k + 2) % 3]], V::uv_offset).x;
+                    i[k] = copy_vertex(i[k], (u1 + u2) / 2);
+                    break;
+                }
             }
         }
     }
 
-    if (attrib & VertexAttrib::TANGENT) {
-        for (int i = 0; i < vec3_pb.size(); ++i) {
-            const glm::vec2& uv = vec2_uv[i];
+    if (Attribs & TANGENT) {
+        for (V& v : vb) {
+            glm::vec2 uv = get_attrib<glm::vec2>(v, V::uv_offset);
             glm::vec3 t0(0.0f, -1.0f, 0.0f);
-            glm::quat t_rot = glm::angleAxis((float)uv.x * glm::two_pi<float>(),
+            glm::quat t_rot = glm::angleAxis((float)(uv.x / uv_repeat_u) * glm::two_pi<float>(),
                                             glm::vec3(0.0f, 0.0f, 1.0f));
 
             glm::vec3 t = glm::rotate(t_rot, t0);
-            vec3_tb.push_back(t);
+            set_attrib(v, V::tangent_offset, t);
         }
     }
 
@@ -140,7 +258,7 @@ void ProceduralShapes::gen_ico_sphere(std::vector<float>& vb,
 /*      if (attrib & VertexAttrib::TANGENT) {
         vec3_tb.resize(vec3_pb.size());
         std::vector<bool> computed(vec3_pb.size(), false);
-        for (glm::u16vec3& i : vec3_ib) {
+        for (u32vec3& i : vec3_ib) {
             if (computed[i.x] && computed[i.y] && computed[i.z]) {
                 continue;
             }
@@ -172,33 +290,30 @@ void ProceduralShapes::gen_ico_sphere(std::vector<float>& vb,
         } 
     } */
 
-    size_t v_size = vec3_pb.size();
-    for (int i = 0; i < v_size; ++i) {
-        if (attrib & VertexAttrib::POS) {
-            vb.insert(vb.end(), {vec3_pb[i].x, vec3_pb[i].y, vec3_pb[i].z});
-        }
-        if (attrib & VertexAttrib::NORM) {
-            vb.insert(vb.end(), {vec3_nb[i].x, vec3_nb[i].y, vec3_nb[i].z});
-        }
-        if (attrib & VertexAttrib::UV) {
-            // 4x repeated on u, 2x repeated on v
-            vb.insert(vb.end(), {vec2_uv[i].x * 4.0f, vec2_uv[i].y * 2.0f});
-        }
-        if (attrib & VertexAttrib::TANGENT) {
-            vb.insert(vb.end(), {vec3_tb[i].x, vec3_tb[i].y, vec3_tb[i].z});
-        }
-    }
+    optimize(vb, ib, report);
+}
 
-    // set index buffer
-    if (i_type == IndexType::LINE) {
-        tri2line(vec3_ib, ib);
-    } else if (i_type == IndexType::TRIANGLE) {
-        ib.clear();
-        for (auto& i : vec3_ib) {
-            ib.insert(ib.end(), { i.x, i.y, i.z });
-        }
-    } else {
-        assert(false);
+void ProceduralShapes::ico_sphere(std::vector<QuantizedVertex>& vb, IndexBuffer& ib, float r, int lod, mesh::Report* report) {
+    // seam and poles are worked out at full precision
+    std::vector<Vertex<POS_NORM_UV_TANGENT>> full;
+    ico_sphere(full, ib, r, lod, report);
+
+    typedef Vertex<POS_NORM_UV_TANGENT> V;
+    vb.resize(full.size());
+    for (size_t i = 0; i < vb.size(); ++i) {
+        QuantizedVertex& v = vb[i];
+        glm::vec3 p = get_attrib<glm::vec3>(full[i], V::position_offset);
+        glm::vec2 uv = get_attrib<glm::vec2>(full[i], V::uv_offset);
+        v.position[0] = half::from_float(p.x);
+        v.position[1] = half::from_float(p.y);
+        v.position[2] = half::from_float(p.z);
+        v.position[3] = half::from_float(1.0f);
+        to_octahedral(get_attrib<glm::vec3>(full[i], V::normal_offset), v.normal);
+        float uv_u = std::round(uv.x * QuantizedVertex::uv_scale);
+        float uv_v = std::round(uv.y * QuantizedVertex::uv_scale);
+        v.uv[0] = int16_t(std::min(std::max(uv_u, -32768.0f), 32767.0f));
+        v.uv[1] = int16_t(std::min(std::max(uv_v, -32768.0f), 32767.0f));
+        to_octahedral(get_attrib<glm::vec3>(full[i], V::tangent_offset), v.tangent);
     }
 }
 
@@ -254,40 +369,60 @@ void ProceduralShapes::gen_cube(std::vector<float>& vb,
     };
 }
 
+void ProceduralShapes::gen_cube(std::vector<Vertex<POS>>& vb,
+                                glm::vec3 half_dim,
+                                IndexType i_type) {
+    std::vector<float> pb;
+    gen_cube(pb, VertexAttrib::POS, half_dim, i_type);
+    vb.resize(pb.size() / 3);
+    memcpy(vb.data(), pb.data(), pb.size() * sizeof(float));
+}
+
+template <typename Index>
 void ProceduralShapes::gen_z_cylinder(std::vector<float>& pb,
-                                      std::vector<uint16_t>& ib,
+                                      std::vector<Index>& ib,
                                       float r,
                                       float height,
                                       int sectors,
                                       int stacks,
-                                      IndexType i_type) {
+                                      IndexType i_type,
+                                      mesh::Report* report) {
     PositionBuffer vec3_pb;
     IndexBuffer vec3_ib;
     z_cylinder(vec3_pb, vec3_ib, r, height, sectors, stacks);
+    optimize(vec3_pb, vec3_ib, report);
     
     // copy to pb, ib
     pb.resize(vec3_pb.size() * 3);
     memcpy(pb.data(), vec3_pb.data(), pb.size() * sizeof(float));
     
-    if (i_type == IndexType::LINE) {
-        tri2line(vec3_ib, ib);
-    } else if (i_type == IndexType::TRIANGLE) {
-        ib.clear();
-        for (auto& i : vec3_ib) {
-            ib.insert(ib.end(), { i.x, i.y, i.z });
-        }
-    } else {
-        assert(false);
-    }
+    copy_indices(vec3_ib, vec3_pb.size(), i_type, ib);
+}
+
+template void ProceduralShapes::gen_z_cylinder<uint16_t>(std::vector<float>&, std::vector<uint16_t>&, float, float, int, int, IndexType, mesh::Report*);
+template void ProceduralShapes::gen_z_cylinder<uint32_t>(std::vector<float>&, std::vector<uint32_t>&, float, float, int, int, IndexType, mesh::Report*);
+
+void ProceduralShapes::gen_z_cylinder(std::vector<float>& pb,
+                                      Indices& ib,
+                                      float r,
+                                      float height,
+                                      int sectors,
+                                      int stacks,
+                                      IndexType i_type,
+                                      mesh::Report* report) {
+    gen_z_cylinder(pb, ib.u32, r, height, sectors, stacks, i_type, report);
+    ib.fit(pb.size() / 3);
 }
 
+template <typename Index>
 void ProceduralShapes::gen_z_capsule(std::vector<float>& pb,
-                                     std::vector<uint16_t>& ib,
+                                     std::vector<Index>& ib,
                                      float r,
                                      float height,
                                      int sectors,
                                      int stacks,
-                                     IndexType i_type) {
+                                     IndexType i_type,
+                                     mesh::Report* report) {
     PositionBuffer vec3_pb;
     IndexBuffer vec3_ib;
     
@@ -319,22 +454,50 @@ void ProceduralShapes::gen_z_capsule(std::vector<float>& pb,
     glm::vec3& bottom = *(vec3_pb.end() - 2);
     top.z = half_height + r;
     bottom.z = -top.z;
+
+    optimize(vec3_pb, vec3_ib, report);
     
     // copy to pb, ib
     pb.resize(vec3_pb.size() * 3);
     memcpy(pb.data(), vec3_pb.data(), pb.size() * sizeof(float));
     
-    if (i_type == IndexType::LINE) {
-        tri2line(vec3_ib, ib);
-    } else if (i_type == IndexType::TRIANGLE) {
-        ib.clear();
-        for (auto& i : vec3_ib) {
-            ib.insert(ib.end(), { i.x, i.y, i.z });
-        }
-    } else {
-        assert(false);
+    copy_indices(vec3_ib, vec3_pb.size(), i_type, ib);
+}
+
+template void ProceduralShapes::gen_z_capsule<uint16_t>(std::vector<float>&, std::vector<uint16_t>&, float, float, int, int, IndexType, mesh::Report*);
+template void ProceduralShapes::gen_z_capsule<uint32_t>(std::vector<float>&, std::vector<uint32_t>&, float, float, int, int, IndexType, mesh::Report*);
+
+void ProceduralShapes::gen_z_capsule(std::vector<float>& pb,
+                                     Indices& ib,
+                                     float r,
+                                     float height,
+                                     int sectors,
+                                     int stacks,
+                                     IndexType i_type,
+                                     mesh::Report* report) {
+    gen_z_capsule(pb, ib.u32, r, height, sectors, stacks, i_type, report);
+    ib.fit(pb.size() / 3);
+}
+
+template <typename V>
+void ProceduralShapes::optimize(std::vector<V>& vb, IndexBuffer& ib, mesh::Report* report) {
+    // mesh::optimize takes a flat index list
+    std::vector<uint32_t> indices;
+    indices.reserve(ib.size() * 3);
+    for (const u32vec3& i : ib) {
+        indices.insert(indices.end(), { i.x, i.y, i.z });
     }
 
+    // convex shapes, nothing to gain on overdraw
+    std::vector<uint32_t> remap;
+    mesh::Report stats = mesh::optimize(indices.data(), indices.size(), vb.size(), remap);
+    for (size_t k = 0; k < ib.size(); ++k) {
+        ib[k] = u32vec3(indices[k * 3], indices[k * 3 + 1], indices[k * 3 + 2]);
+    }
+    mesh::remap_vertices(vb, remap);
+    if (report) {
+        *report = stats;
+    }
 }
 
 void ProceduralShapes::init_icosphere(float r, PositionBuffer& pb, IndexBuffer& ib) {
@@ -367,56 +530,62 @@ void ProceduralShapes::init_icosphere(float r, PositionBuffer& pb, IndexBuffer&
 
     // construct triangles
     // the 'roof'
-    for (uint16_t i = 1; i <= 4; ++i) {
+    for (uint32_t i = 1; i <= 4; ++i) {
         ib.push_back({0, i, i + 1});
     }
     ib.push_back({0, 5, 1});
     
     // the 'walls'
-    for (uint16_t i = 1; i <= 4; ++i) {
+    for (uint32_t i = 1; i <= 4; ++i) {
         ib.push_back({i, i + 5, i + 1});
     }
     ib.push_back({5, 10, 1});
     
-    for (uint16_t i = 2; i <= 5; ++i) {
+    for (uint32_t i = 2; i <= 5; ++i) {
         ib.push_back({i, i + 4, i + 5});
     }
     ib.push_back({1, 10, 6});
 
     // the 'bottom'
-    for (uint16_t i = 6; i <= 9; ++i) {
+    for (uint32_t i = 6; i <= 9; ++i) {
         ib.push_back({11, i + 1, i});
     }
     ib.push_back({11, 6, 10});
 }
 
 void ProceduralShapes::add_icosphere_lod(float r, PositionBuffer& pb, IndexBuffer& ib) {
+    // every edge is shared by 2 triangles, its midpoint is added once.
+    // Keyed on the sorted index pair
+    std::unordered_map<uint64_t, uint32_t> midpoints;
+    midpoints.reserve(ib.size() * 3 / 2);
+    auto midpoint = [&](uint32_t a, uint32_t b) {
+        uint64_t key = a < b ? (uint64_t(a) << 32 | b) : (uint64_t(b) << 32 | a);
+        auto it = midpoints.find(key);
+        if (it != midpoints.end()) {
+            return it->second;
+        }
+        uint32_t pos = uint32_t(pb.size());
+        pb.push_back(extrude(r, pb[a], pb[b]));
+        midpoints.emplace(key, pos);
+        return pos;
+    };
+
     // traverse triangles
     IndexBuffer ib_new;
+    ib_new.reserve(ib.size() * 4);
     for (size_t k = 0; k < ib.size(); ++k) {
         auto& i = ib[k];
 
-        glm::vec3 p0 = pb[i.x];
-        glm::vec3 p1 = pb[i.y];
-        glm::vec3 p2 = pb[i.z];
-        
-        glm::vec3 p01 = extrude(r, p0, p1);
-        glm::vec3 p12 = extrude(r, p1, p2);
-        glm::vec3 p20 = extrude(r, p2, p0);
-        
-        // add new vertices to vb
-        pb.push_back(p01);
-        pb.push_back(p12);
-        pb.push_back(p20);
-        
+        // add new vertices to vb, or find the ones of the neighbours
+        uint32_t pos01 = midpoint(i.x, i.y);
+        uint32_t pos12 = midpoint(i.y, i.z);
+        uint32_t pos20 = midpoint(i.z, i.x);
+
         // add new indices
-        uint16_t pos01 = pb.size() - 3;
-        uint16_t pos12 = pb.size() - 2;
-        uint16_t pos20 = pb.size() - 1;
-        ib_new.push_back(glm::vec3(i.x, pos01, pos20));
-        ib_new.push_back(glm::vec3(i.y, pos12, pos01));
-        ib_new.push_back(glm::vec3(i.z, pos20, pos12));
-        ib_new.push_back(glm::vec3(pos20, pos01, pos12));
+        ib_new.push_back(u32vec3(i.x, pos01, pos20));
+        ib_new.push_back(u32vec3(i.y, pos12, pos01));
+        ib_new.push_back(u32vec3(i.z, pos20, pos12));
+        ib_new.push_back(u32vec3(pos20, pos01, pos12));
     }
 
     ib.clear();
@@ -428,14 +597,16 @@ glm::vec3 ProceduralShapes::extrude(float r, const glm::vec3& p0, const glm::vec
     return r * normalize(mid);
 }
 
-void ProceduralShapes::tri2line(const IndexBuffer& src, std::vector<uint16_t>& dest) {
+template <typename Index>
+void ProceduralShapes::tri2line(const IndexBuffer& src, std::vector<Index>& dest) {
     // TODO: every line gets drawn twice. Fix this
     dest.clear();
+    dest.reserve(src.size() * 6);
     for (auto& i : src) {
         dest.insert(dest.end(), {
-            i.x, i.y,
-            i.y, i.z,
-            i.z, i.x
+            Index(i.x), Index(i.y),
+            Index(i.y), Index(i.z),
+            Index(i.z), Index(i.x)
         });
     }
 }
@@ -451,8 +622,8 @@ void ProceduralShapes::morph_cylinder2hemisphere(PositionBuffer::iterator beg,
     // u -- radial index -- sectors
     float delta_phi = (phi_end - phi_start) / stacks;
     float phi = phi_start;
-    for (uint16_t v = 0; v <= stacks; ++v, phi += delta_phi) {
-        for (uint16_t u = 0; u < sectors; ++u) {
+    for (int v = 0; v <= stacks; ++v, phi += delta_phi) {
+        for (int u = 0; u < sectors; ++u) {
             float sin_phi = sin(phi);
             glm::vec3& p = *(beg + v * sectors + u);
             p.x = (p.x - center.x) * sin_phi + center.x;
@@ -488,17 +659,17 @@ void ProceduralShapes::z_cylinder(PositionBuffer& pb, IndexBuffer& ib, float r,
     //   |   /  |
     //   |  /   |
     //   p00 -- p10
-    for (uint16_t v = 0; v < stacks; ++v) {
-        for (uint16_t u = 1; u <= sectors; ++u) {
-            uint16_t i10 = v * sectors + u;
-            uint16_t i00 = i10 - 1;
-            uint16_t i01 = i00 + sectors;
-            uint16_t i11 = i01 + 1;
+    for (int v = 0; v < stacks; ++v) {
+        for (int u = 1; u <= sectors; ++u) {
+            uint32_t i10 = uint32_t(v * sectors + u);
+            uint32_t i00 = i10 - 1;
+            uint32_t i01 = i00 + uint32_t(sectors);
+            uint32_t i11 = i01 + 1;
             
             // loop back
             if (u == sectors) {
-                i10 -= sectors;
-                i11 -= sectors;
+                i10 -= uint32_t(sectors);
+                i11 -= uint32_t(sectors);
             }
             
             ib.push_back({i00, i11, i01});
@@ -515,20 +686,20 @@ void ProceduralShapes::z_cylinder(PositionBuffer& pb, IndexBuffer& ib, float r,
     //      \   |
     //       \  |
     //      bottom
-    uint16_t i_top = pb.size() - 1;
-    uint16_t i_bottom = pb.size() - 2;
-    for (uint16_t u = 1; u <= sectors; ++u) {
+    uint32_t i_top = uint32_t(pb.size() - 1);
+    uint32_t i_bottom = uint32_t(pb.size() - 2);
+    for (int u = 1; u <= sectors; ++u) {
         // bottom
-        uint16_t i1 = u;
-        uint16_t i0 = u - 1;
+        uint32_t i1 = uint32_t(u);
+        uint32_t i0 = uint32_t(u - 1);
         if (u == sectors) {
-            i1 -= sectors;
+            i1 -= uint32_t(sectors);
         }
         ib.push_back({i_bottom, i1, i0});
         
         // top
-        i1 += stacks * sectors;
-        i0 += stacks * sectors;
+        i1 += uint32_t(stacks * sectors);
+        i0 += uint32_t(stacks * sectors);
         ib.push_back({i_top, i0, i1});
     }
 }
@@ -2,6 +2,10 @@
 
 #include <glm/vec3.hpp>
 
+#include "mesh_optimize.h"
+
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 class ProceduralShapes {
@@ -21,35 +25,120 @@ public:
         POS_NORM_UV_TANGENT = 0x0f
     };
     
-    typedef glm::tvec3<uint16_t, glm::highp> u16vec3;
+    typedef glm::tvec3<uint32_t, glm::highp> u32vec3;
     typedef std::vector<glm::vec3> PositionBuffer;
     typedef std::vector<glm::vec3> NormalBuffer;
     typedef std::vector<glm::vec2> UVBuffer;
-    typedef std::vector<u16vec3> IndexBuffer;
+    typedef std::vector<u32vec3> IndexBuffer;
     typedef std::vector<glm::vec3> TangentBuffer;
-    
-    static void gen_ico_sphere(std::vector<float>& vb,
-                               std::vector<uint16_t>& ib,
-                               VertexAttrib attrib,
+
+    // 16 bit indices while the vertex count allows it, 32 bit past 65536 vertices.
+    // For bgfx::createIndexBuffer: data() and bytes(), BGFX_BUFFER_INDEX32 when index32 is set
+    struct Indices {
+        bool index32 = false;
+        std::vector<uint16_t> u16;
+        std::vector<uint32_t> u32;
+
+        const void* data() const;
+        uint32_t bytes() const;
+        // of indices
+        size_t count() const;
+
+        // from u32 to u16 when vertex_count allows it
+        void fit(size_t vertex_count);
+    };
+
+    // One interleaved vertex with the attributes in Attribs, a VertexAttrib mask.
+    // Position, normal, uv and tangent in this order, all float. The offsets are in bytes.
+    // vertex_layout<Attribs>() in vertex_layout.h gives the matching bgfx::VertexLayout
+    template <int Attribs>
+    struct Vertex {
+        static_assert(Attribs & POS, "vertices need a position");
+
+        static constexpr size_t position_offset = 0;
+        static constexpr size_t normal_offset = position_offset + 3 * sizeof(float);
+        static constexpr size_t uv_offset = normal_offset + ((Attribs & NORM) ? 3 : 0) * sizeof(float);
+        static constexpr size_t tangent_offset = uv_offset + ((Attribs & UV) ? 2 : 0) * sizeof(float);
+        static constexpr size_t stride = tangent_offset + ((Attribs & TANGENT) ? 3 : 0) * sizeof(float);
+
+        static constexpr int attribs = Attribs;
+
+        float data[stride / sizeof(float)];
+    };
+
+    // POS_NORM_UV_TANGENT in 20 bytes instead of 44, for pbr_quantized_vs.sc. Same attribute order.
+    // position: half floats, w = 1. normal, tangent: octahedral, snorm16.
+    // uv: 16 bit fixed point with 12 fractional bits, up to +-8. Half floats would be off by
+    // several texels past u = 4, where the sphere's seam copies go.
+    // quantized_vertex_layout() in vertex_layout.h gives the bgfx::VertexLayout
+    struct QuantizedVertex {
+        static constexpr int attribs = POS_NORM_UV_TANGENT;
+        static constexpr float uv_scale = 4096.0f;
+
+        uint16_t position[4];
+        int16_t normal[2];
+        int16_t uv[2];
+        int16_t tangent[2];
+    };
+
+    // Index: uint16_t or uint32_t, instantiated in the .cpp along with V: Vertex<POS>, Vertex<POS_NORM>,
+    // Vertex<POS_NORM_UV>, Vertex<POS_NORM_UV_TANGENT> and QuantizedVertex. Meshes are built with 32 bit indices,
+    // ib is left empty when the vertex count does not fit Index.
+    // Triangles come in vertex cache order and vertices in fetch order, see mesh_optimize.h.
+    // report: vertex cache stats of the subdivision order and of the optimized one
+    template <typename V, typename Index>
+    static void gen_ico_sphere(std::vector<V>& vb,
+                               std::vector<Index>& ib,
                                float r,
                                int lod,
-                               IndexType i_type);
-    
+                               IndexType i_type,
+                               mesh::Report* report = nullptr);
+
+    template <typename V>
+    static void gen_ico_sphere(std::vector<V>& vb,
+                               Indices& ib,
+                               float r,
+                               int lod,
+                               IndexType i_type,
+                               mesh::Report* report = nullptr);
+
+    template <typename Index>
     static void gen_z_cylinder(std::vector<float>& pb,
-                               std::vector<uint16_t>& ib,
+                               std::vector<Index>& ib,
                                float r,
                                float height,
                                int sectors,
                                int stacks,
-                               IndexType i_type);
-    
+                               IndexType i_type,
+                               mesh::Report* report = nullptr);
+
+    static void gen_z_cylinder(std::vector<float>& pb,
+                               Indices& ib,
+                               float r,
+                               float height,
+                               int sectors,
+                               int stacks,
+                               IndexType i_type,
+                               mesh::Report* report = nullptr);
+
+    template <typename Index>
     static void gen_z_capsule(std::vector<float>& pb,
-                              std::vector<uint16_t>& ib,
+                              std::vector<Index>& ib,
                               float r,
                               float height,
                               int sectors,
                               int stacks,
-                              IndexType i_type);
+                              IndexType i_type,
+                              mesh::Report* report = nullptr);
+
+    static void gen_z_capsule(std::vector<float>& pb,
+                              Indices& ib,
+                              float r,
+                              float height,
+                              int sectors,
+                              int stacks,
+                              IndexType i_type,
+                              mesh::Report* report = nullptr);
 
     // Cube with hard edge
     // Geometry is so simple that it does not need index buffer
@@ -57,15 +146,32 @@ public:
                          VertexAttrib attrib,
                          glm::vec3 half_dim,
                          IndexType i_type);
+
+    static void gen_cube(std::vector<Vertex<POS>>& vb,
+                         glm::vec3 half_dim,
+                         IndexType i_type);
     
     
 private:
-    
+    // every attribute written straight into vb, the seam and pole copies included
+    template <int Attribs>
+    static void ico_sphere(std::vector<Vertex<Attribs>>& vb, IndexBuffer& ib, float r, int lod, mesh::Report* report);
+
+    // built at full precision, quantized at the end
+    static void ico_sphere(std::vector<QuantizedVertex>& vb, IndexBuffer& ib, float r, int lod, mesh::Report* report);
+
+    template <typename Index>
+    static void copy_indices(const IndexBuffer& src, size_t vertex_count, IndexType i_type, std::vector<Index>& dst);
+
     static void init_icosphere(float r, PositionBuffer& pb, IndexBuffer& ib);
     
     static void add_icosphere_lod(float r, PositionBuffer& pb, IndexBuffer& ib);
     
     static void z_cylinder(PositionBuffer& pb, IndexBuffer& ib, float r, float height, int sectors, int stacks);
+
+    // vertex cache and fetch order, vb remapped along
+    template <typename V>
+    static void optimize(std::vector<V>& vb, IndexBuffer& ib, mesh::Report* report);
     
     static void morph_cylinder2hemisphere(PositionBuffer::iterator beg,
                                           glm::vec3 center,
@@ -77,5 +183,6 @@ private:
     
     static glm::vec3 extrude(float r, const glm::vec3& p0, const glm::vec3& p1);
     
-    static void tri2line(const IndexBuffer& src, std::vector<uint16_t>& dest);
+    template <typename Index>
+    static void tri2line(const IndexBuffer& src, std::vector<Index>& dest);
 };
@@ -0,0 +1,201 @@
+#include <iostream>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "programs.h"
+#include "file_io.h"
+
+namespace io {
+
+namespace {
+
+std::string dir_of(const std::string& path) {
+	size_t slash = path.find_last_of('/');
+	return slash == std::string::npos ? std::string(".") : path.substr(0, slash);
+}
+
+// invalid handle for a missing file, instead of handing bgfx a null.
+// Reloads skip the pack, the rebuilt file is the loose one
+bgfx::ShaderHandle try_load_shader(const std::string& path, bool reload) {
+	const bgfx::Memory* mem = load_memory(path.c_str(), !reload);
+	if (!mem) {
+		return BGFX_INVALID_HANDLE;
+	}
+	return bgfx::createShader(mem);
+}
+
+}
+
+ProgramRegistry::ProgramRegistry() {
+	_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (_inotify < 0) {
+		std::cout << "Cannot watch shaders, hot reload is off" << std::endl;
+	}
+}
+
+ProgramRegistry::~ProgramRegistry() {
+	if (_inotify >= 0) {
+		close(_inotify);
+	}
+}
+
+void ProgramRegistry::watch(const std::string& path) {
+	if (_inotify < 0) {
+		return;
+	}
+	// the directory, the compiler may replace the file instead of writing it in place
+	std::string dir = dir_of(path);
+	int wd = inotify_add_watch(_inotify, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd >= 0) {
+		_watch_dirs[wd] = dir;
+	}
+}
+
+uint16_t ProgramRegistry::shader(const std::string& path) {
+	auto it = _shader_ids.find(path);
+	if (it != _shader_ids.end()) {
+		return it->second;
+	}
+
+	Shader s;
+	s.path = path;
+	s.handle = try_load_shader(path, false);
+	s.dirty = false;
+	if (!bgfx::isValid(s.handle)) {
+		std::cout << "Cannot load shader " << path << std::endl;
+	}
+	uint16_t id = uint16_t(_shaders.size());
+	_shaders.push_back(s);
+	_shader_ids[path] = id;
+	watch(path);
+	return id;
+}
+
+ProgramId ProgramRegistry::load(const std::string& vs_name, const std::string& fs_name) {
+	uint16_t vs = shader(vs_name);
+	uint16_t fs = shader(fs_name);
+	auto key = std::make_pair(vs, fs);
+	auto it = _program_ids.find(key);
+	if (it != _program_ids.end()) {
+		return it->second;
+	}
+
+	Program p;
+	p.vs = vs;
+	p.fs = fs;
+	p.handle = BGFX_INVALID_HANDLE;
+	if (bgfx::isValid(_shaders[vs].handle) && bgfx::isValid(_shaders[fs].handle)) {
+		// shaders are shared, the registry destroys them
+		p.handle = bgfx::createProgram(_shaders[vs].handle, _shaders[fs].handle, false);
+	}
+	ProgramId id = ProgramId(_programs.size());
+	_programs.push_back(p);
+	_program_ids[key] = id;
+	return id;
+}
+
+bgfx::ProgramHandle ProgramRegistry::handle(ProgramId id) const {
+	return _programs[id].handle;
+}
+
+int ProgramRegistry::poll() {
+	if (_inotify < 0) {
+		return 0;
+	}
+
+	bool changed = false;
+	alignas(inotify_event) char buffer[4096];
+	for (;;) {
+		ssize_t size = read(_inotify, buffer, sizeof(buffer));
+		if (size <= 0) {
+			break;
+		}
+		for (char* p = buffer; p < buffer + size;) {
+			const inotify_event* e = (const inotify_event*)p;
+			p += sizeof(inotify_event) + e->len;
+			auto dir = _watch_dirs.find(e->wd);
+			if (e->len == 0 || dir == _watch_dirs.end()) {
+				continue;
+			}
+			auto it = _shader_ids.find(dir->second + "/" + e->name);
+			if (it != _shader_ids.end()) {
+				_shaders[it->second].dirty = true;
+				changed = true;
+			}
+		}
+	}
+	if (!changed) {
+		return 0;
+	}
+
+	// new shaders first, the old ones stay in use wherever a program fails to link
+	std::vector<bgfx::ShaderHandle> old_shaders;
+	std::vector<bgfx::ShaderHandle> new_shaders(_shaders.size(), BGFX_INVALID_HANDLE);
+	for (size_t i = 0; i < _shaders.size(); ++i) {
+		Shader& s = _shaders[i];
+		if (!s.dirty) {
+			continue;
+		}
+		s.dirty = false;
+		new_shaders[i] = try_load_shader(s.path, true);
+		if (!bgfx::isValid(new_shaders[i])) {
+			std::cout << "Cannot reload shader " << s.path << ", keeping the old one" << std::endl;
+			continue;
+		}
+		if (bgfx::isValid(s.handle)) {
+			old_shaders.push_back(s.handle);
+		}
+		s.handle = new_shaders[i];
+	}
+
+	int swapped = 0;
+	for (Program& p : _programs) {
+		if (!bgfx::isValid(new_shaders[p.vs]) && !bgfx::isValid(new_shaders[p.fs])) {
+			continue;
+		}
+		if (!bgfx::isValid(_shaders[p.vs].handle) || !bgfx::isValid(_shaders[p.fs].handle)) {
+			continue;
+		}
+		bgfx::ProgramHandle handle = bgfx::createProgram(_shaders[p.vs].handle, _shaders[p.fs].handle, false);
+		if (!bgfx::isValid(handle)) {
+			std::cout << "Cannot relink " << _shaders[p.vs].path << " + " << _shaders[p.fs].path << std::endl;
+			continue;
+		}
+		// frames already recorded keep the old one alive
+		if (bgfx::isValid(p.handle)) {
+			bgfx::destroy(p.handle);
+		}
+		p.handle = handle;
+		++swapped;
+	}
+	for (bgfx::ShaderHandle s : old_shaders) {
+		bgfx::destroy(s);
+	}
+
+	std::cout << "Reloaded " << swapped << " program(s)" << std::endl;
+	return swapped;
+}
+
+void ProgramRegistry::clear() {
+	for (Program& p : _programs) {
+		if (bgfx::isValid(p.handle)) {
+			bgfx::destroy(p.handle);
+		}
+	}
+	for (Shader& s : _shaders) {
+		if (bgfx::isValid(s.handle)) {
+			bgfx::destroy(s.handle);
+		}
+	}
+	_programs.clear();
+	_shaders.clear();
+	_program_ids.clear();
+	_shader_ids.clear();
+}
+
+ProgramRegistry& programs() {
+	static ProgramRegistry registry;
+	return registry;
+}
+
+}
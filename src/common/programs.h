@@ -0,0 +1,70 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bgfx/bgfx.h"
+
+namespace io {
+
+typedef uint16_t ProgramId;
+
+// Programs loaded once per pair of compiled shaders, shaders once per path.
+// The .bin files are watched through inotify. A rebuilt one is reloaded in poll(),
+// along with every program using it, and swapped in behind the same id.
+// A shader that fails to load keeps its previous version
+class ProgramRegistry {
+public:
+	ProgramRegistry();
+	~ProgramRegistry();
+
+	ProgramRegistry(const ProgramRegistry&) = delete;
+	ProgramRegistry& operator=(const ProgramRegistry&) = delete;
+
+	// loaded on the first call for the pair. The id stays the same across reloads
+	ProgramId load(const std::string& vs_name, const std::string& fs_name);
+
+	// current program of id. Only changes in poll(), resolve it again every frame
+	bgfx::ProgramHandle handle(ProgramId id) const;
+
+	// swaps in the programs whose shaders changed on disk. Call between frames.
+	// Returns the number of programs swapped
+	int poll();
+
+	// destroys every program and shader, before bgfx::shutdown(). Ids are invalid afterwards
+	void clear();
+
+private:
+	struct Shader {
+		std::string path;
+		bgfx::ShaderHandle handle;
+		bool dirty;
+	};
+
+	struct Program {
+		uint16_t vs;
+		uint16_t fs;
+		bgfx::ProgramHandle handle;
+	};
+
+	uint16_t shader(const std::string& path);
+
+	void watch(const std::string& path);
+
+	std::vector<Shader> _shaders;
+	std::vector<Program> _programs;
+	std::unordered_map<std::string, uint16_t> _shader_ids;
+	std::map<std::pair<uint16_t, uint16_t>, ProgramId> _program_ids;
+
+	int _inotify;
+	std::unordered_map<int, std::string> _watch_dirs;
+};
+
+// Shared by the whole application. Application::run polls it at the start of every frame
+// and clears it before shutting bgfx down
+ProgramRegistry& programs();
+
+}
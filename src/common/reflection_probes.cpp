@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "reflection_probes.h"
+
+namespace pcp {
+
+namespace {
+
+// between the application views and the bake views of pre_computations.
+// Two views per capture, then the prefilter passes of the probes' own baker
+const bgfx::ViewId capture_view_first = 10;
+const uint16_t capture_view_count = 32;
+const bgfx::ViewId probe_bake_view_first = capture_view_first + capture_view_count;
+const uint16_t probe_bake_view_count = 50;
+
+}
+
+ReflectionProbes::ReflectionProbes(const SceneFn& scene,
+									int capture_res,
+									int res,
+									int mip_levels,
+									int steps_per_frame)
+	: _scene(scene),
+	  _capture_res(capture_res),
+	  _res(res),
+	  _mip_levels(mip_levels),
+	  _budget(0),
+	  _baker(probe_bake_view_first, probe_bake_view_count),
+	  _probe(0),
+	  _step(0) {
+	_depth = bgfx::createTexture2D(uint16_t(capture_res),
+									uint16_t(capture_res),
+									false,
+									1,
+									bgfx::TextureFormat::D24S8,
+									BGFX_TEXTURE_RT_WRITE_ONLY);
+	_baker.prefilter_samples(mip_levels);
+	set_budget(steps_per_frame);
+}
+
+ReflectionProbes::~ReflectionProbes() {
+	_baker.release();
+	for (Probe& p : _probes) {
+		for (bgfx::FrameBufferHandle fb : p.faces) {
+			bgfx::destroy(fb);
+		}
+		bgfx::destroy(p.capture);
+		bgfx::destroy(p.prefilter);
+	}
+	bgfx::destroy(_depth);
+}
+
+int ReflectionProbes::add(const glm::vec3& pos) {
+	Probe p;
+	p.pos = pos;
+	p.ready = false;
+	p.capture = bgfx::createTextureCube(uint16_t(_capture_res),
+										true,
+										1,
+										bgfx::TextureFormat::RGBA16F,
+										BGFX_SAMPLER_UVW_CLAMP | BGFX_TEXTURE_RT);
+	p.prefilter = bgfx::createTextureCube(uint16_t(_res),
+											true,
+											1,
+											bgfx::TextureFormat::RGBA16F,
+											BGFX_SAMPLER_UVW_CLAMP | BGFX_TEXTURE_RT);
+	for (int side = 0; side < 6; ++side) {
+		// mips of the capture are generated once its last side is done
+		bgfx::Attachment attachments[2];
+		attachments[0].init(p.capture,
+							bgfx::Access::Write,
+							uint16_t(side),
+							1,
+							0,
+							side == 5 ? BGFX_RESOLVE_AUTO_GEN_MIPS : BGFX_RESOLVE_NONE);
+		attachments[1].init(_depth, bgfx::Access::Write, 0, 1, 0, BGFX_RESOLVE_NONE);
+		p.faces[side] = bgfx::createFrameBuffer(2, attachments, false);
+	}
+	_probes.push_back(p);
+	return int(_probes.size()) - 1;
+}
+
+void ReflectionProbes::move(int probe, const glm::vec3& pos) {
+	_probes[probe].pos = pos;
+}
+
+void ReflectionProbes::set_budget(int steps_per_frame) {
+	int max_steps = std::min(capture_view_count / 2, probe_bake_view_count / _mip_levels);
+	_budget = std::max(1, std::min(steps_per_frame, max_steps));
+}
+
+int ReflectionProbes::budget() const {
+	return _budget;
+}
+
+bgfx::TextureHandle ReflectionProbes::prefilter_map(int probe) const {
+	return _probes[probe].prefilter;
+}
+
+bool ReflectionProbes::ready(int probe) const {
+	return _probes[probe].ready;
+}
+
+void ReflectionProbes::update() {
+	// the passes of last frame went out with it
+	_baker.release();
+	for (size_t i : _done) {
+		_probes[i].ready = true;
+	}
+	_done.clear();
+	if (_probes.empty()) {
+		return;
+	}
+
+	bgfx::ViewId view = capture_view_first;
+	for (int n = 0; n < _budget; ++n) {
+		Probe& p = _probes[_probe];
+		if (_step < 6) {
+			capture(p, _step, view);
+			view += 2;
+		} else {
+			// the capture views come first, this frame's sides are in already
+			prefilter(p, _step - 6);
+		}
+
+		if (++_step == 12) {
+			_done.push_back(_probe);
+			_step = 0;
+			_probe = (_probe + 1) % _probes.size();
+		}
+	}
+}
+
+void ReflectionProbes::capture(Probe& probe, int side, bgfx::ViewId view) {
+	CaptureContext ctx;
+	ctx.view = view;
+	ctx.sky_view = view + 1;
+	ctx.view_mtx = cube_face_view(side) * glm::translate(glm::mat4(1.0f), -probe.pos);
+	ctx.proj = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 100.0f);
+	ctx.pos = probe.pos;
+
+	bgfx::setViewClear(ctx.view, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, 0x000000ff, 1.0f, 0);
+	bgfx::setViewClear(ctx.sky_view, BGFX_CLEAR_NONE);
+	for (bgfx::ViewId v : {ctx.view, ctx.sky_view}) {
+		bgfx::setViewRect(v, 0, 0, uint16_t(_capture_res), uint16_t(_capture_res));
+		bgfx::setViewFrameBuffer(v, probe.faces[side]);
+		bgfx::setViewTransform(v, &ctx.view_mtx[0][0], &ctx.proj[0][0]);
+	}
+	_scene(ctx);
+}
+
+void ReflectionProbes::prefilter(Probe& probe, int side) {
+	for (int m = 0; m < _mip_levels; ++m) {
+		glm::vec4 mip_roughness = glm::vec4((float)m / (float)(_mip_levels - 1),
+											(float)_capture_res,
+											(float)(m + 1),
+											0.0f);
+		std::vector<UniformContext> ucs = {{_baker.u_roughness, &mip_roughness, 1}};
+		_baker.submit_face(probe.prefilter, m, side, probe.capture, _res >> m, _baker.prefilter_prog(), ucs);
+	}
+}
+
+}
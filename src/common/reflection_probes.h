@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "bgfx/bgfx.h"
+#include "pre_computations.h"
+
+namespace pcp {
+
+// one side of a probe capture. Both views render to the same face, clears are already set
+struct CaptureContext {
+	bgfx::ViewId view;		// scene, view transform set
+	bgfx::ViewId sky_view;	// after view, transform left to the caller, e.g. rotation only
+	glm::mat4 view_mtx;
+	glm::mat4 proj;
+	glm::vec3 pos;			// of the probe
+};
+
+typedef std::function<void(const CaptureContext&)> SceneFn;
+
+// Local reflections. Every probe captures the scene into a cube map around its position,
+// which is then prefiltered like the skybox in gen_prefilter_map.
+// Updates go round robin over the probes, a fixed number of steps per frame:
+// a step is either the capture of one side, or the prefiltering of one side over all mips.
+// A probe's prefilter map is refreshed one side at a time, it can mix two rounds for a few frames
+class ReflectionProbes {
+public:
+	ReflectionProbes(const SceneFn& scene,
+						int capture_res = 128,
+						int res = 64,
+						int mip_levels = 5,
+						int steps_per_frame = 2);
+	~ReflectionProbes();
+
+	// returns the probe id
+	int add(const glm::vec3& pos);
+
+	void move(int probe, const glm::vec3& pos);
+
+	// clamped to what the reserved views allow
+	void set_budget(int steps_per_frame);
+
+	int budget() const;
+
+	// records this frame's steps. Call once per frame, before bgfx::frame()
+	void update();
+
+	// sampled like the output of gen_prefilter_map
+	bgfx::TextureHandle prefilter_map(int probe) const;
+
+	// once a whole round has been rendered
+	bool ready(int probe) const;
+
+private:
+	struct Probe {
+		glm::vec3 pos;
+		bgfx::TextureHandle capture;	// RGBA16F, with mips for the prefilter samples
+		std::array<bgfx::FrameBufferHandle, 6> faces;
+		bgfx::TextureHandle prefilter;
+		bool ready;
+	};
+
+	void capture(Probe& probe, int side, bgfx::ViewId view);
+
+	void prefilter(Probe& probe, int side);
+
+	SceneFn _scene;
+	int _capture_res;
+	int _res;
+	int _mip_levels;
+	int _budget;
+
+	bgfx::TextureHandle _depth;	// shared by every capture
+	CubeBaker _baker;
+	std::vector<Probe> _probes;
+
+	// round robin position. Steps 0 to 5 capture, 6 to 11 prefilter
+	size_t _probe;
+	int _step;
+	// rounds done last frame. Ready once that frame is out
+	std::vector<size_t> _done;
+};
+
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+namespace pcp {
+
+// radical inverse in base 2, y of the i-th hammersley point
+inline float van_der_corput(uint32_t bits) {
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	return float(bits) * 2.3283064365386963e-10f; // / 0x100000000
+}
+
+// cos of the angle between n and a GGX distributed half vector, xi_y uniform in [0, 1)
+inline float ggx_cos_theta(float xi_y, float roughness) {
+	float a = roughness * roughness;
+	return std::sqrt((1.0f - xi_y) / (1.0f + (a * a - 1.0f) * xi_y));
+}
+
+// normal distribution function, GGX/Trowbridge-Reitz
+inline float distribution_ggx(float n_h, float roughness) {
+	float a = roughness * roughness;
+	float a2 = a * a;
+	float denom = n_h * n_h * (a2 - 1.0f) + 1.0f;
+	return a2 / (float(M_PI) * denom * denom);
+}
+
+}
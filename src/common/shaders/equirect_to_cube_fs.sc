@@ -0,0 +1,13 @@
+$input v_frag_pos // in world space
+
+#include <bgfx_shader.sh>
+
+SAMPLER2D(s_env, 0);
+
+void main() {
+    vec3 dir = normalize(v_frag_pos);
+    // longitude around y, latitude from the horizon. Row 0 of the map looks straight up
+    vec2 uv = vec2(atan2(dir.z, dir.x) / (2.0f * M_PI) + 0.5f, 0.5f - asin(dir.y) / M_PI);
+    // explicit lod, the wrap around at the seam would throw off the derivatives
+    gl_FragColor = vec4(texture2DLod(s_env, uv, 0.0f).xyz, 1.0f);
+}
@@ -4,26 +4,42 @@ $input v_frag_pos // in world space
 #include "sampling.sc"
 
 SAMPLERCUBE(s_env, 0);
+SAMPLER2D(s_samples, 1);
 
-uniform vec4 u_roughness;
+uniform vec4 u_roughness; // x: roughness, y: face resolution of s_env at mip 0, z: row of s_samples
 
 void main() {
     vec3 n = normalize(v_frag_pos);
     vec3 r = n;
     vec3 v = r;
 
-    const int sample_count = 1024;
+    // filtered importance sampling. Each sample reads the mip whose texels
+    // cover about the solid angle the sample stands for, so a few samples
+    // give a smooth result instead of bright dots
+    const int sample_count = 64;
+    float roughness = u_roughness[0];
+    float sa_texel = 4.0 * M_PI / (6.0 * u_roughness[1] * u_roughness[1]);
+    int row = int(u_roughness[2]);
+    vec3 tangent;
+    vec3 bitangent;
+    tangent_frame(n, tangent, bitangent);
     vec3 color = vec3(0.0f);
     float total_weight = 0.0f;
 
     for (int i = 0; i < sample_count; ++i) {
-        vec2 xi = hammersley(i, sample_count);
-        vec3 h = importance_sample_ggx(xi, n, u_roughness[0]);
+        // tangent space half vector, and its pdf
+        vec4 h_pdf = texelFetch(s_samples, ivec2(i, row), 0);
+        vec3 h = tangent * h_pdf.x + bitangent * h_pdf.y + n * h_pdf.z;
         vec3 l  = normalize(2.0 * dot(v, h) * h - v);
 
         float n_l = max(dot(n, l), 0.0);
         if(n_l > 0.0) {
-            color += textureCube(s_env, l).rgb * n_l;
+            // n == v, so the pdf of l reduces to D / 4
+            float pdf = h_pdf.w + 0.0001;
+            float sa_sample = 1.0 / (float(sample_count) * pdf);
+            float mip = roughness == 0.0 ? 0.0 : max(0.5 * log2(sa_sample / sa_texel) + 1.0, 0.0);
+
+            color += textureCubeLod(s_env, l, mip).rgb * n_l;
             total_weight += n_l;
         }
     }
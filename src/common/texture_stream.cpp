@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+
+#include "texture_stream.h"
+#include "allocator.h"
+#include "mip_chain.h"
+
+namespace io {
+
+namespace {
+
+const bgfx::Memory* rgba(uint32_t color, int count) {
+	const bgfx::Memory* mem = bgfx::alloc(uint32_t(count * 4));
+	for (int i = 0; i < count; ++i) {
+		mem->data[i * 4 + 0] = uint8_t(color >> 24);
+		mem->data[i * 4 + 1] = uint8_t(color >> 16);
+		mem->data[i * 4 + 2] = uint8_t(color >> 8);
+		mem->data[i * 4 + 3] = uint8_t(color);
+	}
+	return mem;
+}
+
+template <typename T>
+bool is_ready(std::future<T>& f) {
+	return f.valid() && f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+uint16_t mip_size(uint32_t size, uint8_t level) {
+	return uint16_t(std::max(size >> level, 1u));
+}
+
+// first level at most preview_size wide and high, the last one if the chain stops before
+uint8_t preview_level(const bimg::ImageContainer& c, uint32_t preview_size) {
+	uint8_t level = 0;
+	while (level + 1 < c.m_numMips && std::max(mip_size(c.m_width, level), mip_size(c.m_height, level)) > preview_size) {
+		++level;
+	}
+	return level;
+}
+
+}
+
+TextureStreamer::TextureStreamer() : _budget(4 << 20) {}
+
+TextureStreamer::~TextureStreamer() {
+	// bgfx is gone by now, only the images are left to free
+	for (Stream& s : _streams) {
+		for (bimg::ImageContainer* c : s.sources) {
+			bimg::imageFree(c);
+		}
+	}
+}
+
+StreamId TextureStreamer::add_2d(std::future<bimg::ImageContainer*> image, uint32_t placeholder, uint64_t flags) {
+	Stream s;
+	s.image = std::move(image);
+	s.flags = flags;
+	s.cube = false;
+	s.removed = false;
+	s.shown = bgfx::createTexture2D(1, 1, false, 1, bgfx::TextureFormat::RGBA8, flags, rgba(placeholder, 1));
+	s.next = BGFX_INVALID_HANDLE;
+	s.filled = false;
+	_streams.push_back(std::move(s));
+	return StreamId(_streams.size() - 1);
+}
+
+StreamId TextureStreamer::add_cube(const std::array<bimg::ImageContainer*, 6>& faces,
+									uint32_t placeholder,
+									uint64_t flags) {
+	Stream s;
+	// the faces are converted along with the other decodes, the chains are built in parallel anyway
+	s.faces = std::async(std::launch::async, [faces]() {
+		std::array<bimg::ImageContainer*, 6> chains;
+		for (int i = 0; i < 6; ++i) {
+			chains[i] = faces[i] ? build_mip_chain(&mem::default_allocator(), *faces[i], MipFilter::Srgb) : nullptr;
+			if (faces[i]) {
+				bimg::imageFree(faces[i]);
+			}
+		}
+		return chains;
+	});
+	s.flags = flags;
+	s.cube = true;
+	s.removed = false;
+	s.shown = bgfx::createTextureCube(1, false, 1, bgfx::TextureFormat::RGBA8, flags, rgba(placeholder, 6));
+	s.next = BGFX_INVALID_HANDLE;
+	s.filled = false;
+	_streams.push_back(std::move(s));
+	return StreamId(_streams.size() - 1);
+}
+
+bgfx::TextureHandle TextureStreamer::handle(StreamId id) const {
+	return _streams[id].shown;
+}
+
+bool TextureStreamer::complete(StreamId id) const {
+	const Stream& s = _streams[id];
+	return !bgfx::isValid(s.next) && s.sources.empty() && !s.image.valid() && !s.faces.valid();
+}
+
+uint32_t TextureStreamer::arrive(Stream& s) {
+	if (s.removed || !(is_ready(s.image) || is_ready(s.faces))) {
+		return 0;
+	}
+
+	if (s.cube) {
+		std::array<bimg::ImageContainer*, 6> faces = s.faces.get();
+		bool ok = std::all_of(faces.begin(), faces.end(), [](bimg::ImageContainer* c) { return c != nullptr; });
+		for (bimg::ImageContainer* c : faces) {
+			if (ok) {
+				s.sources.push_back(c);
+			} else if (c) {
+				bimg::imageFree(c);
+			}
+		}
+	} else if (bimg::ImageContainer* c = s.image.get()) {
+		assert(c->m_numLayers == 1 && !c->m_cubeMap);
+		s.sources.push_back(c);
+	}
+	if (s.sources.empty()) {
+		std::cout << "Cannot stream a texture, keeping its placeholder" << std::endl;
+		return 0;
+	}
+
+	// the preview goes up at once, whatever the budget
+	begin_level(s, preview_level(*s.sources[0], preview_size));
+	uint32_t bytes = 0;
+	while (!s.filled) {
+		bytes += upload_band(s, UINT32_MAX);
+	}
+	swap(s);
+	return bytes;
+}
+
+void TextureStreamer::begin_level(Stream& s, uint8_t level) {
+	const bimg::ImageContainer& c = *s.sources[0];
+	bool has_mips = c.m_numMips > 1;
+	bgfx::TextureFormat::Enum format = bgfx::TextureFormat::Enum(c.m_format);
+	s.next = s.cube
+		? bgfx::createTextureCube(mip_size(c.m_width, level), has_mips, 1, format, s.flags)
+		: bgfx::createTexture2D(mip_size(c.m_width, level), mip_size(c.m_height, level), has_mips, 1, format, s.flags);
+	s.next_level = level;
+
+	s.next_bytes = 0;
+	for (uint8_t lod = level; lod < c.m_numMips; ++lod) {
+		bimg::ImageMip mip;
+		bimg::imageGetRawData(c, 0, lod, c.m_data, c.m_size, mip);
+		s.next_bytes += uint64_t(mip.m_size) * s.sources.size();
+	}
+
+	s.mip = uint8_t(c.m_numMips - 1);
+	s.face = 0;
+	s.block_row = 0;
+	s.filled = false;
+}
+
+uint32_t TextureStreamer::upload_band(Stream& s, uint32_t max_bytes) {
+	const bimg::ImageContainer& c = *s.sources[s.face];
+	bimg::ImageMip mip;
+	bimg::imageGetRawData(c, 0, s.mip, c.m_data, c.m_size, mip);
+
+	// whole rows of blocks. Block compressed formats take 4 texel rows per block
+	const bimg::ImageBlockInfo& info = bimg::getBlockInfo(c.m_format);
+	uint32_t block_rows = std::max<uint32_t>(info.minBlockY, (mip.m_height + info.blockHeight - 1) / info.blockHeight);
+	uint32_t row_bytes = mip.m_size / block_rows;
+	uint32_t rows = block_rows <= info.minBlockY
+		? block_rows
+		: std::min(block_rows - s.block_row, std::max(max_bytes / row_bytes, 1u));
+	// the rectangle stays within the level, bimg rounds block compressed mips up to whole blocks
+	uint32_t y = s.block_row * info.blockHeight;
+	uint32_t width = mip_size(c.m_width, s.mip);
+	uint32_t height = std::min<uint32_t>(rows * info.blockHeight, mip_size(c.m_height, s.mip) - y);
+
+	// copied, the image can go any time after this
+	const bgfx::Memory* mem = bgfx::copy(mip.m_data + s.block_row * row_bytes, rows * row_bytes);
+	uint8_t lod = uint8_t(s.mip - s.next_level);
+	if (s.cube) {
+		bgfx::updateTextureCube(s.next, 0, s.face, lod, 0, uint16_t(y), uint16_t(width), uint16_t(height), mem);
+	} else {
+		bgfx::updateTexture2D(s.next, 0, lod, 0, uint16_t(y), uint16_t(width), uint16_t(height), mem);
+	}
+
+	s.block_row += rows;
+	if (s.block_row == block_rows) {
+		s.block_row = 0;
+		if (++s.face == s.sources.size()) {
+			s.face = 0;
+			if (s.mip == s.next_level) {
+				s.filled = true;
+			} else {
+				--s.mip;
+			}
+		}
+	}
+	return rows * row_bytes;
+}
+
+void TextureStreamer::swap(Stream& s) {
+	// frames already recorded keep the old one alive
+	bgfx::destroy(s.shown);
+	s.shown = s.next;
+	s.next = BGFX_INVALID_HANDLE;
+	if (s.next_level > 0) {
+		// 4 times the size of the previous version, about 16 times the bytes
+		begin_level(s, uint8_t(s.next_level > 2 ? s.next_level - 2 : 0));
+		return;
+	}
+	for (bimg::ImageContainer* c : s.sources) {
+		bimg::imageFree(c);
+	}
+	s.sources.clear();
+}
+
+void TextureStreamer::release(Stream& s) {
+	for (bgfx::TextureHandle tex : {s.shown, s.next}) {
+		if (bgfx::isValid(tex)) {
+			bgfx::destroy(tex);
+		}
+	}
+	s.shown = BGFX_INVALID_HANDLE;
+	s.next = BGFX_INVALID_HANDLE;
+	// a decode still running is waited for, its image has to be freed
+	if (s.image.valid()) {
+		s.sources.push_back(s.image.get());
+	}
+	if (s.faces.valid()) {
+		std::array<bimg::ImageContainer*, 6> faces = s.faces.get();
+		s.sources.insert(s.sources.end(), faces.begin(), faces.end());
+	}
+	for (bimg::ImageContainer* c : s.sources) {
+		if (c) {
+			bimg::imageFree(c);
+		}
+	}
+	s.sources.clear();
+	s.removed = true;
+}
+
+bgfx::TextureHandle TextureStreamer::finish(StreamId id) {
+	Stream& s = _streams[id];
+	if (s.image.valid()) {
+		s.image.wait();
+	}
+	if (s.faces.valid()) {
+		s.faces.wait();
+	}
+	arrive(s);
+	while (bgfx::isValid(s.next)) {
+		while (!s.filled) {
+			upload_band(s, UINT32_MAX);
+		}
+		swap(s);
+	}
+	return s.shown;
+}
+
+void TextureStreamer::remove(StreamId id) {
+	release(_streams[id]);
+}
+
+uint32_t TextureStreamer::update() {
+	uint32_t spent = 0;
+	for (Stream& s : _streams) {
+		spent += arrive(s);
+	}
+
+	// the band of the smallest version in the works, until the budget runs out.
+	// At least one band a frame, whatever the budget
+	while (spent == 0 || spent < _budget) {
+		Stream* next = nullptr;
+		for (Stream& s : _streams) {
+			if (bgfx::isValid(s.next) && (!next || s.next_bytes < next->next_bytes)) {
+				next = &s;
+			}
+		}
+		if (!next) {
+			break;
+		}
+		spent += upload_band(*next, _budget > spent ? _budget - spent : 0);
+		if (next->filled) {
+			swap(*next);
+		}
+	}
+	return spent;
+}
+
+void TextureStreamer::set_budget(uint32_t bytes_per_frame) {
+	_budget = std::max(bytes_per_frame, 1u);
+}
+
+uint32_t TextureStreamer::budget() const {
+	return _budget;
+}
+
+int TextureStreamer::pending() const {
+	int count = 0;
+	for (StreamId id = 0; id < _streams.size(); ++id) {
+		count += complete(id) ? 0 : 1;
+	}
+	return count;
+}
+
+void TextureStreamer::clear() {
+	for (Stream& s : _streams) {
+		release(s);
+	}
+	_streams.clear();
+}
+
+TextureStreamer& streamer() {
+	static TextureStreamer instance;
+	return instance;
+}
+
+}
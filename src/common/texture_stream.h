@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#include "bgfx/bgfx.h"
+#include "bimg/bimg.h"
+
+namespace io {
+
+typedef uint16_t StreamId;
+
+// Textures uploaded over several frames, low detail first.
+// A stream shows a 1x1 placeholder until its image is decoded, then a preview made of the mips
+// at most preview_size wide, uploaded right away. Larger versions, each 4 times the size of the previous one,
+// are filled a band of rows at a time under a per-frame byte budget, smallest mip first,
+// and swapped in behind the same id once complete. Smaller streams go before larger ones
+class TextureStreamer {
+public:
+	TextureStreamer();
+	~TextureStreamer();
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// image with its full mip chain, as load_image_async(name, filter) hands them out. Takes ownership.
+	// placeholder: 0xRRGGBBAA shown until the image is there. A null image keeps it for good
+	StreamId add_2d(std::future<bimg::ImageContainer*> image, uint32_t placeholder, uint64_t flags = 0);
+
+	// faces in +x, -x, +y, -y, +z, -z order, converted to RGBA8 with a full mip chain on the io threads.
+	// Takes ownership of them
+	StreamId add_cube(const std::array<bimg::ImageContainer*, 6>& faces,
+						uint32_t placeholder,
+						uint64_t flags = BGFX_SAMPLER_UVW_CLAMP);
+
+	// current texture of id. Only changes in update(), resolve it again every frame
+	bgfx::TextureHandle handle(StreamId id) const;
+
+	// true once the full resolution texture is in
+	bool complete(StreamId id) const;
+
+	// waits for the image and uploads whatever is left of it at once
+	bgfx::TextureHandle finish(StreamId id);
+
+	// destroys the textures of id and drops what is left to upload. The id is not reused
+	void remove(StreamId id);
+
+	// uploads up to the budget and swaps in the versions completed. Call between frames.
+	// Returns the bytes uploaded
+	uint32_t update();
+
+	void set_budget(uint32_t bytes_per_frame);
+
+	uint32_t budget() const;
+
+	// streams not complete yet
+	int pending() const;
+
+	// destroys every texture, before bgfx::shutdown(). Ids are invalid afterwards
+	void clear();
+
+	static const uint32_t preview_size = 64;
+
+private:
+	struct Stream {
+		std::future<bimg::ImageContainer*> image;
+		std::future<std::array<bimg::ImageContainer*, 6>> faces;
+		std::vector<bimg::ImageContainer*> sources;	// one per face once decoded
+		uint64_t flags;
+		bool cube;
+		bool removed;
+
+		bgfx::TextureHandle shown;
+		bgfx::TextureHandle next;	// being filled
+		uint8_t next_level;			// its first mip in the sources
+		uint64_t next_bytes;
+
+		// the next band to upload into next. Mips go from the smallest up, faces one after another
+		uint8_t mip;
+		uint8_t face;
+		uint32_t block_row;
+		bool filled;
+	};
+
+	// takes the decoded image in if it is there, and uploads its preview. Returns the bytes uploaded
+	uint32_t arrive(Stream& s);
+
+	void begin_level(Stream& s, uint8_t level);
+
+	// one band of at most max_bytes, at least one row of blocks. Returns its size
+	uint32_t upload_band(Stream& s, uint32_t max_bytes);
+
+	void swap(Stream& s);
+
+	void release(Stream& s);
+
+	std::vector<Stream> _streams;
+	uint32_t _budget;
+};
+
+// Shared by the whole application. Application::run updates it at the start of every frame
+// and clears it before shutting bgfx down
+TextureStreamer& streamer();
+
+}
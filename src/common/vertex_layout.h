@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cassert>
+
+#include "bgfx/bgfx.h"
+
+#include "procedural_shapes.h"
+
+// bgfx layout of ProceduralShapes::Vertex<Attribs>, from the same mask.
+// Kept apart so the shapes do not depend on bgfx
+template <int Attribs>
+bgfx::VertexLayout vertex_layout() {
+	typedef ProceduralShapes::Vertex<Attribs> V;
+	bgfx::VertexLayout layout;
+	layout.begin();
+	layout.add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float);
+	if (Attribs & ProceduralShapes::NORM) {
+		layout.add(bgfx::Attrib::Normal, 3, bgfx::AttribType::Float);
+	}
+	if (Attribs & ProceduralShapes::UV) {
+		layout.add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Float);
+	}
+	if (Attribs & ProceduralShapes::TANGENT) {
+		layout.add(bgfx::Attrib::Tangent, 3, bgfx::AttribType::Float);
+	}
+	layout.end();
+	assert(layout.getStride() == sizeof(V));
+	assert(!(Attribs & ProceduralShapes::UV) || layout.getOffset(bgfx::Attrib::TexCoord0) == V::uv_offset);
+	assert(!(Attribs & ProceduralShapes::TANGENT) || layout.getOffset(bgfx::Attrib::Tangent) == V::tangent_offset);
+	return layout;
+}
+
+// the whole buffer, copied
+template <int Attribs>
+bgfx::VertexBufferHandle create_vertex_buffer(const std::vector<ProceduralShapes::Vertex<Attribs>>& vb, uint16_t flags = 0) {
+	return bgfx::createVertexBuffer(bgfx::copy(vb.data(), uint32_t(vb.size() * sizeof(vb[0]))),
+									vertex_layout<Attribs>(),
+									flags);
+}
+
+// ProceduralShapes::QuantizedVertex. Normal and tangent come out normalized, the uv as plain integers
+inline bgfx::VertexLayout quantized_vertex_layout() {
+	bgfx::VertexLayout layout;
+	layout.begin()
+		.add(bgfx::Attrib::Position, 4, bgfx::AttribType::Half)
+		.add(bgfx::Attrib::Normal, 2, bgfx::AttribType::Int16, true)
+		.add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Int16)
+		.add(bgfx::Attrib::Tangent, 2, bgfx::AttribType::Int16, true)
+	.end();
+	assert(layout.getStride() == sizeof(ProceduralShapes::QuantizedVertex));
+	return layout;
+}
+
+inline bgfx::VertexBufferHandle create_vertex_buffer(const std::vector<ProceduralShapes::QuantizedVertex>& vb, uint16_t flags = 0) {
+	return bgfx::createVertexBuffer(bgfx::copy(vb.data(), uint32_t(vb.size() * sizeof(vb[0]))),
+									quantized_vertex_layout(),
+									flags);
+}
@@ -1,14 +1,87 @@
+#include <array>
+#include <chrono>
+#include <future>
 #include <iostream>
+#include <memory>
 #include <vector>
+#include <sys/stat.h>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include "common/allocator.h"
 #include "common/application.hpp"
 #include "common/file_io.h"
 #include "common/pre_computations.h"
+#include "common/reflection_probes.h"
 #include "common/procedural_shapes.h"
+#include "common/vertex_layout.h"
 #include "controls.hpp"
 
+namespace {
+
+// a skybox decoded off the main thread, along with its sh irradiance.
+// Either six faces or an equirectangular map
+struct Environment {
+	std::array<bimg::ImageContainer*, 6> faces;
+	bimg::ImageContainer* equirect;
+	pcp::SH9 sh;
+	bool ok;
+};
+
+void free_environment(Environment& env) {
+	if (env.equirect) {
+		bimg::imageFree(env.equirect);
+		env.equirect = nullptr;
+	}
+	for (bimg::ImageContainer*& face : env.faces) {
+		if (face) {
+			bimg::imageFree(face);
+			face = nullptr;
+		}
+	}
+}
+
+// dir holds right/left/top/bottom/front/back.jpg, like textures/skybox
+Environment load_environment(const std::string& dir) {
+	static const char* names[6] = {"right", "left", "top", "bottom", "front", "back"};
+	std::array<std::future<bimg::ImageContainer*>, 6> loads;
+	for (int i = 0; i < 6; ++i) {
+		loads[i] = io::load_image_async(dir + "/" + names[i] + ".jpg");
+	}
+
+	Environment env;
+	env.equirect = nullptr;
+	env.ok = true;
+	for (int i = 0; i < 6; ++i) {
+		env.faces[i] = loads[i].get();
+		env.ok = env.ok && env.faces[i] != nullptr;
+	}
+	if (env.ok) {
+		env.sh = pcp::project_sh9(env.faces);
+	} else {
+		free_environment(env);
+	}
+	return env;
+}
+
+// .hdr/.exr
+Environment load_environment_equirect(const std::string& name) {
+	Environment env;
+	env.faces.fill(nullptr);
+	env.equirect = io::load_image_equirect(name);
+	env.ok = env.equirect != nullptr;
+	if (env.ok) {
+		env.sh = pcp::project_sh9_equirect(*env.equirect);
+	}
+	return env;
+}
+
+bool has_extension(const std::string& path, const std::string& ext) {
+	return path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+}
+
 class PbrApp : public app::Application
 {
 	// lights
@@ -35,21 +108,35 @@ class PbrApp : public app::Application
 	bgfx::VertexBufferHandle skybox_vb;
 
 	// shader pograms
-	bgfx::ProgramHandle pbr_prog;
-	bgfx::ProgramHandle skybox_prog;
-
-	// textures
-	bgfx::TextureHandle tex_albedo;
-	bgfx::TextureHandle tex_roughness;
-	bgfx::TextureHandle tex_metallic;
-	bgfx::TextureHandle tex_normal;
-	bgfx::TextureHandle tex_ao;
-	bgfx::TextureHandle tex_height;
-	bgfx::TextureHandle tex_skybox;
-	bgfx::TextureHandle tex_skybox_irr;
+	io::ProgramId pbr_prog;
+	io::ProgramId skybox_prog;
+
+	// textures. The material and the first skybox stream in, see io::TextureStreamer.
+	// A dropped environment replaces the skybox with tex_skybox
+	io::MaterialStreams material;
+	io::StreamId skybox_stream;
+	bgfx::TextureHandle tex_skybox = BGFX_INVALID_HANDLE;
 	bgfx::TextureHandle tex_skybox_prefilter;
 	bgfx::TextureHandle tex_brdf_lut;
 
+	// diffuse IBL
+	pcp::SH9 sh_irradiance;
+
+	// environment dropped onto the window. Decoded on a worker, then re-baked a few passes per frame.
+	// The current maps stay in use until the new set is complete
+	std::future<Environment> env_loading;
+	std::unique_ptr<pcp::IncrementalBaker> env_baker;
+	pcp::SH9 env_sh;
+
+	// local reflections around the sphere. The light markers give it something to reflect
+	std::unique_ptr<pcp::ReflectionProbes> probes;
+	int probe = -1;
+	bool use_probe = false;
+	int probe_budget = 2;
+
+	glm::mat4 model;
+	glm::vec4 light_color_intensities[light_count];
+
 	// uniforms
 	bgfx::UniformHandle u_model_inv_t;
 	bgfx::UniformHandle u_view_inv;
@@ -57,16 +144,13 @@ class PbrApp : public app::Application
 	bgfx::UniformHandle u_light_colors;
 	bgfx::UniformHandle u_albedo;
 	bgfx::UniformHandle u_metallic_roughness_ao_scale;
+	bgfx::UniformHandle u_sh;
 
 	// samplers
 	bgfx::UniformHandle s_albedo;
-	bgfx::UniformHandle s_roughness;
-	bgfx::UniformHandle s_metallic;
+	bgfx::UniformHandle s_orm;
 	bgfx::UniformHandle s_normal;
-	bgfx::UniformHandle s_ao;
-	bgfx::UniformHandle s_height;
 	bgfx::UniformHandle s_skybox;
-	bgfx::UniformHandle s_skybox_irr;
 	bgfx::UniformHandle s_skybox_prefilter;
 	bgfx::UniformHandle s_brdf_lut;
 
@@ -88,55 +172,78 @@ class PbrApp : public app::Application
 	void initialize(int argc, char** argv) {
 		// bgfx::setDebug(BGFX_DEBUG_TEXT | BGFX_DEBUG_STATS);
 
-		std::vector<float> vb;
-		std::vector<uint16_t> ib;
-
-		// sphere vertices
-		ProceduralShapes::gen_ico_sphere(vb, ib, ProceduralShapes::VertexAttrib::POS_NORM_UV_TANGENT,
-										1.5f, 3, ProceduralShapes::IndexType::TRIANGLE);
-		bgfx::VertexLayout v_layout;
-		v_layout.begin()
-			.add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
-			.add(bgfx::Attrib::Normal, 3, bgfx::AttribType::Float)
-			.add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Float)
-			.add(bgfx::Attrib::Tangent, 3, bgfx::AttribType::Float)
-		.end();
-		sphere_vb = bgfx::createVertexBuffer(bgfx::copy(vb.data(), vb.size() * sizeof(float)), v_layout);
-		sphere_ib = bgfx::createIndexBuffer(bgfx::copy(ib.data(), ib.size() * sizeof(uint16_t)));
+		// shaders and textures out of the single mapped pbr.pack when the build made one, loose files otherwise
+		io::mount_pack("pbr.pack");
+
+		// sphere vertices. Quantized to 20 bytes where the gpu takes half floats, 44 bytes of floats otherwise
+		ProceduralShapes::Indices ib;
+		bool quantized = (bgfx::getCaps()->supported & BGFX_CAPS_VERTEX_ATTRIB_HALF) != 0;
+		if (quantized) {
+			std::vector<ProceduralShapes::QuantizedVertex> vb;
+			ProceduralShapes::gen_ico_sphere(vb, ib, 1.5f, 3, ProceduralShapes::IndexType::TRIANGLE);
+			sphere_vb = create_vertex_buffer(vb);
+		} else {
+			std::vector<ProceduralShapes::Vertex<ProceduralShapes::POS_NORM_UV_TANGENT>> vb;
+			ProceduralShapes::gen_ico_sphere(vb, ib, 1.5f, 3, ProceduralShapes::IndexType::TRIANGLE);
+			sphere_vb = create_vertex_buffer(vb);
+		}
+		sphere_ib = bgfx::createIndexBuffer(bgfx::copy(ib.data(), ib.bytes()), ib.index32 ? BGFX_BUFFER_INDEX32 : BGFX_BUFFER_NONE);
 
 		// skybox vertices
-		ProceduralShapes::gen_cube(vb, ProceduralShapes::VertexAttrib::POS, glm::vec3(1.0f, 1.0f, 1.0f), ProceduralShapes::TRIANGLE);
-		bgfx::VertexLayout skybox_layout;
-		skybox_layout.begin()
-			.add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
-		.end();
-		skybox_vb = bgfx::createVertexBuffer(bgfx::copy(vb.data(), vb.size() * sizeof(float)), skybox_layout);
-
-		pbr_prog = io::load_program("shaders/glsl/pbr_vs.bin", "shaders/glsl/pbr_fs.bin");
-		assert(bgfx::isValid(pbr_prog));
-		skybox_prog = io::load_program("shaders/glsl/skybox_vs.bin", "shaders/glsl/skybox_fs.bin");
-		assert(bgfx::isValid(skybox_prog));
-
-		// textures
-		std::string model_name = "textures/rough_rock";
-		tex_albedo 		= io::load_texture_2d(model_name + "/albedo.png");
-		tex_roughness 	= io::load_texture_2d(model_name + "/roughness.png");
-		tex_metallic 	= io::load_texture_2d(model_name + "/metallic.png");
-		tex_normal 		= io::load_texture_2d(model_name + "/normal.png");
-		tex_ao 			= io::load_texture_2d(model_name + "/ao.png");
-		tex_height		= io::load_texture_2d(model_name + "/height.png");
-		tex_skybox = io::load_texture_cube({"textures/skybox/right.jpg",
-		 									"textures/skybox/left.jpg",
-		 									"textures/skybox/top.jpg",
-		 									"textures/skybox/bottom.jpg",
-		 									"textures/skybox/front.jpg",
-		 									"textures/skybox/back.jpg",});
+		std::vector<ProceduralShapes::Vertex<ProceduralShapes::POS>> skybox;
+		ProceduralShapes::gen_cube(skybox, glm::vec3(1.0f, 1.0f, 1.0f), ProceduralShapes::TRIANGLE);
+		skybox_vb = create_vertex_buffer(skybox);
+
+		pbr_prog = io::programs().load(quantized ? "shaders/glsl/pbr_quantized_vs.bin" : "shaders/glsl/pbr_vs.bin",
+										"shaders/glsl/pbr_fs.bin");
+		assert(bgfx::isValid(io::programs().handle(pbr_prog)));
+		skybox_prog = io::programs().load("shaders/glsl/skybox_vs.bin", "shaders/glsl/skybox_fs.bin");
+		assert(bgfx::isValid(io::programs().handle(skybox_prog)));
+
+		// textures. Every file is read, decoded and mipmapped on the io threads at once.
+		// The material streams in over the first frames, flat placeholders until then
+		material = io::stream_material("textures/rough_rock");
+		const std::array<std::string, 6> skybox_faces = {"textures/skybox/right.jpg",
+														"textures/skybox/left.jpg",
+														"textures/skybox/top.jpg",
+														"textures/skybox/bottom.jpg",
+														"textures/skybox/front.jpg",
+														"textures/skybox/back.jpg",};
+		std::array<std::future<bimg::ImageContainer*>, 6> skybox_loads;
+		for (int i = 0; i < 6; ++i) {
+			skybox_loads[i] = io::load_image_async(skybox_faces[i]);
+		}
+
+		// faces are decoded once, for the sh projection and the cube map
+		std::array<bimg::ImageContainer*, 6> skybox_images;
+		for (int i = 0; i < 6; ++i) {
+			skybox_images[i] = skybox_loads[i].get();
+			assert(skybox_images[i]);
+		}
+		sh_irradiance = pcp::project_sh9(skybox_images);
+		int skybox_res = int(skybox_images[0]->m_width);
+		skybox_stream = io::streamer().add_cube(skybox_images, 0x0f0f0fff);
 		// tex_skybox = io::load_ktx_cube_map("textures/skybox/texture-cubemap-test.ktx");
 		// tex_skybox = io::load_texture_cube_immutable_ktx("textures/skybox/warehouse.ktx");
-		tex_skybox_irr = pcp::gen_irradiance_map(tex_skybox, 32);
-		tex_skybox_prefilter = pcp::gen_prefilter_map(tex_skybox, 256, 5);
+
+		// IBL bakes are cached on disk, keyed on the skybox content.
+		// Missing ones are baked, all prefilter passes going out in the same frame
+		pcp::BakeCache bake_cache("ibl_cache", io::hash_assets({skybox_faces.begin(), skybox_faces.end()}));
+		pcp::CubeBaker baker;
+		if (!bake_cache.has_prefilter_map(256, 5)) {
+			// the bake reads the whole cube, now
+			io::streamer().finish(skybox_stream);
+		}
+		tex_skybox_prefilter = bake_cache.prefilter_map(io::streamer().handle(skybox_stream), skybox_res, 256, 5, &baker);
+		baker.flush();
 		// tex_brdf_lut = io::load_texture_2d("textures/skybox/brdf_lut_v_flipped.png");
-		tex_brdf_lut = pcp::gen_brdf_lut(512);
+		// integrated at build time by brdf_lut_gen. Integrated here the same way if missing
+		tex_brdf_lut = io::load_texture("../common_textures/brdf_lut.ktx", BGFX_SAMPLER_UVW_CLAMP);
+		if (!bgfx::isValid(tex_brdf_lut)) {
+			tex_brdf_lut = pcp::gen_brdf_lut(512);
+		}
+		bake_cache.store();
+		env_baker.reset(new pcp::IncrementalBaker());
 
 		// uniforms
 		u_model_inv_t = bgfx::createUniform("u_model_inv_t", bgfx::UniformType::Mat4);
@@ -146,19 +253,21 @@ class PbrApp : public app::Application
 
 		u_albedo = bgfx::createUniform("u_albedo", bgfx::UniformType::Vec4);
 		u_metallic_roughness_ao_scale = bgfx::createUniform("u_metallic_roughness_ao_scale", bgfx::UniformType::Vec4);
+		u_sh = bgfx::createUniform("u_sh", bgfx::UniformType::Vec4, 9);
 
 		// samplers
 		s_albedo = bgfx::createUniform("s_albedo", bgfx::UniformType::Sampler);
-		s_roughness = bgfx::createUniform("s_roughness", bgfx::UniformType::Sampler);
-		s_metallic = bgfx::createUniform("s_metallic", bgfx::UniformType::Sampler);
+		s_orm = bgfx::createUniform("s_orm", bgfx::UniformType::Sampler);
 		s_normal = bgfx::createUniform("s_normal", bgfx::UniformType::Sampler);
-		s_ao = bgfx::createUniform("s_ao", bgfx::UniformType::Sampler);
-		s_height = bgfx::createUniform("s_height", bgfx::UniformType::Sampler);
 		s_skybox = bgfx::createUniform("s_skybox", bgfx::UniformType::Sampler);
-		s_skybox_irr = bgfx::createUniform("s_skybox_irr", bgfx::UniformType::Sampler);
 		s_skybox_prefilter = bgfx::createUniform("s_skybox_prefilter", bgfx::UniformType::Sampler);
 		s_brdf_lut = bgfx::createUniform("s_brdf_lut", bgfx::UniformType::Sampler);
 
+		probes.reset(new pcp::ReflectionProbes([this](const pcp::CaptureContext& ctx) {
+			draw_scene(ctx.view, ctx.sky_view, ctx.view_mtx, ctx.proj, tex_skybox_prefilter);
+		}));
+		probe = probes->add(glm::vec3(0.0f, 0.0f, 0.0f));
+
 		bgfx::setViewClear(opaque_id,
 							BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH,
 							0x0f0f0fff,
@@ -169,19 +278,19 @@ class PbrApp : public app::Application
 	}
 
 	int shutdown() {
+		if (env_loading.valid()) {
+			Environment env = env_loading.get();
+			free_environment(env);
+		}
+		env_baker.reset();
+		probes.reset();
 		bgfx::destroy(sphere_vb);
 		bgfx::destroy(sphere_ib);
 		bgfx::destroy(skybox_vb);
-		bgfx::destroy(pbr_prog);
-		bgfx::destroy(skybox_prog);
-		bgfx::destroy(tex_albedo);
-		bgfx::destroy(tex_roughness);
-		bgfx::destroy(tex_metallic);
-		bgfx::destroy(tex_normal);
-		bgfx::destroy(tex_ao);
-		bgfx::destroy(tex_height);
-		bgfx::destroy(tex_skybox);
-		bgfx::destroy(tex_skybox_irr);
+		// streamed textures go with io::streamer()
+		if (bgfx::isValid(tex_skybox)) {
+			bgfx::destroy(tex_skybox);
+		}
 		bgfx::destroy(tex_skybox_prefilter);
 		bgfx::destroy(tex_brdf_lut);
 		bgfx::destroy(u_model_inv_t);
@@ -190,14 +299,11 @@ class PbrApp : public app::Application
 		bgfx::destroy(u_light_colors);
 		bgfx::destroy(u_albedo);
 		bgfx::destroy(u_metallic_roughness_ao_scale);
+		bgfx::destroy(u_sh);
 		bgfx::destroy(s_albedo);
-		bgfx::destroy(s_roughness);
-		bgfx::destroy(s_metallic);
+		bgfx::destroy(s_orm);
 		bgfx::destroy(s_normal);
-		bgfx::destroy(s_ao);
-		bgfx::destroy(s_height);
 		bgfx::destroy(s_skybox);
-		bgfx::destroy(s_skybox_irr);
 		bgfx::destroy(s_skybox_prefilter);
 		bgfx::destroy(s_brdf_lut);
 
@@ -218,35 +324,23 @@ class PbrApp : public app::Application
 		glm::mat4 proj = glm::perspective(glm::radians(60.0f), float(getWidth()) / getHeight(), 0.1f, 100.0f);
 		glm::mat4 view = glm::lookAt(Ctrl::eye,
 									Ctrl::eye + Ctrl::front, Ctrl::up);
-		glm::mat4 view_inv = glm::inverse(view);
 		bgfx::setViewTransform(opaque_id, &view[0][0], &proj[0][0]);
 		bgfx::setViewRect(opaque_id, 0, 0, uint16_t(getWidth()), uint16_t(getHeight()));
-		bgfx::setUniform(u_view_inv, &view_inv);
+		bgfx::setViewRect(skybox_id, 0, 0, uint16_t(getWidth()), uint16_t(getHeight()));
 
 		Ctrl::model_control();
 		// rotation order: z-y-x
-		glm::mat4 model(1.0f);
+		model = glm::mat4(1.0f);
 		model = glm::rotate(model, float(Ctrl::model_euler.z), glm::vec3(0.0f, 0.0f, 1.0f));
 		model = glm::rotate(model, float(Ctrl::model_euler.y), glm::vec3(0.0f, 1.0f, 0.0f));
 		model = glm::rotate(model, float(Ctrl::model_euler.x), glm::vec3(1.0f, 0.0f, 0.0f));
-		bgfx::setTransform(&model[0][0]);
-		glm::mat4 model_inv_t = glm::transpose(glm::inverse(model));
-		bgfx::setUniform(u_model_inv_t, &model_inv_t);
 
 		// mterial & height map control
 		Ctrl::material_control();
 		Ctrl::height_map_control();
-		bgfx::setUniform(u_albedo, &Ctrl::albedo);
-		float mra[4] = {Ctrl::metallic, Ctrl::roughness, Ctrl::ao, Ctrl::height_map_scale};
-		bgfx::setUniform(u_metallic_roughness_ao_scale, mra);
 
 		// light control
 		// TODO: lighting position computation is not correct
-		glm::vec4 view_light_pos[light_count];
-		for (int i = 0; i < light_count; ++i) {
-			view_light_pos[i] = view * glm::vec4(light_pos[i], 1.0f);
-		}
-		bgfx::setUniform(u_light_pos, view_light_pos, light_count);
 		{
 			ImGui::Begin("lights");
 			std::string color_name = "light color  ";
@@ -259,42 +353,179 @@ class PbrApp : public app::Application
 			}
 			ImGui::End();
 		}
-		glm::vec4 light_color_intensities[4];
 		for (int i = 0; i < light_count; ++i) {
 			light_color_intensities[i] = glm::vec4(light_colors[i].x * light_intensities[i],
 													light_colors[i].y * light_intensities[i],
 													light_colors[i].z * light_intensities[i],
 													light_colors[i].w * light_intensities[i]);
 		}
+
+		// reflection probe control
+		{
+			ImGui::Begin("reflection probe");
+			ImGui::Checkbox("local reflections", &use_probe);
+			if (ImGui::SliderInt("steps per frame", &probe_budget, 1, 12)) {
+				probes->set_budget(probe_budget);
+			}
+			ImGui::End();
+		}
+
+		// allocator counters
+		{
+			ImGui::Begin("memory");
+			auto show = [](const char* name, const mem::Stats& s) {
+				ImGui::Text("%s: %.2f MB, peak %.2f MB", name, s.bytes / 1048576.0, s.peak_bytes / 1048576.0);
+				ImGui::Text("  alloc %llu (pooled %llu), realloc %llu, free %llu",
+							(unsigned long long)s.alloc_calls,
+							(unsigned long long)s.pool_hits,
+							(unsigned long long)s.realloc_calls,
+							(unsigned long long)s.free_calls);
+			};
+			show("default", mem::default_allocator().stats());
+			show("scratch", mem::scratch_stats());
+			ImGui::End();
+		}
+
+		// texture streaming
+		{
+			ImGui::Begin("streaming");
+			int budget_kb = int(io::streamer().budget() / 1024);
+			if (ImGui::SliderInt("KB per frame", &budget_kb, 64, 16384)) {
+				io::streamer().set_budget(uint32_t(budget_kb) * 1024);
+			}
+			ImGui::Text("%d texture(s) pending", io::streamer().pending());
+			ImGui::End();
+		}
+
+		update_environment();
+
+		// the probe sees the scene with the skybox reflections, never its own
+		bgfx::TextureHandle prefilter = use_probe && probes->ready(probe)
+			? probes->prefilter_map(probe)
+			: tex_skybox_prefilter;
+		draw_scene(opaque_id, skybox_id, view, proj, prefilter);
+		if (use_probe) {
+			probes->update();
+		}
+
+		// do not call bgfx::frame() here. Or imgui would flash
+		// bgfx::frame();
+	}
+
+	bgfx::TextureHandle skybox() const {
+		return bgfx::isValid(tex_skybox) ? tex_skybox : io::streamer().handle(skybox_stream);
+	}
+
+	// sphere, the light markers with local reflections on, then the skybox
+	void draw_scene(bgfx::ViewId opaque_view,
+					bgfx::ViewId sky_view,
+					const glm::mat4& view,
+					const glm::mat4& proj,
+					bgfx::TextureHandle prefilter) {
+		glm::vec4 albedo(Ctrl::albedo.x, Ctrl::albedo.y, Ctrl::albedo.z, Ctrl::albedo.w);
+		submit_pbr(opaque_view, view, model, albedo, prefilter);
+		if (use_probe) {
+			for (int i = 0; i < light_count; ++i) {
+				glm::mat4 marker = glm::translate(glm::mat4(1.0f), light_pos[i]);
+				marker = glm::scale(marker, glm::vec3(0.3f));
+				submit_pbr(opaque_view, view, marker, glm::vec4(1.0f), prefilter);
+			}
+		}
+
+		// skybox has to be in a separate drawcall since uniform changed
+		glm::mat4 sky = glm::mat4(glm::mat3(view));
+		bgfx::setViewTransform(sky_view, &sky[0][0], &proj[0][0]);
+		bgfx::setTexture(0, s_skybox, skybox());
+		bgfx::setVertexBuffer(0, skybox_vb);
+		bgfx::setState(skybox_state);
+		bgfx::submit(sky_view, io::programs().handle(skybox_prog));
+	}
+
+	// every uniform of pbr_prog, some of them depend on the view
+	void submit_pbr(bgfx::ViewId view_id,
+					const glm::mat4& view,
+					const glm::mat4& model_mtx,
+					const glm::vec4& albedo,
+					bgfx::TextureHandle prefilter) {
+		glm::mat4 view_inv = glm::inverse(view);
+		bgfx::setUniform(u_view_inv, &view_inv);
+		bgfx::setTransform(&model_mtx[0][0]);
+		glm::mat4 model_inv_t = glm::transpose(glm::inverse(model_mtx));
+		bgfx::setUniform(u_model_inv_t, &model_inv_t);
+
+		bgfx::setUniform(u_albedo, &albedo);
+		float mra[4] = {Ctrl::metallic, Ctrl::roughness, Ctrl::ao, Ctrl::height_map_scale};
+		bgfx::setUniform(u_metallic_roughness_ao_scale, mra);
+
+		glm::vec4 view_light_pos[light_count];
+		for (int i = 0; i < light_count; ++i) {
+			view_light_pos[i] = view * glm::vec4(light_pos[i], 1.0f);
+		}
+		bgfx::setUniform(u_light_pos, view_light_pos, light_count);
 		bgfx::setUniform(u_light_colors, light_color_intensities, light_count);
-		
-  		bgfx::setTexture(0, s_albedo, tex_albedo);
-		bgfx::setTexture(1, s_roughness, tex_roughness);
-		bgfx::setTexture(2, s_metallic, tex_metallic);
-		bgfx::setTexture(3, s_normal, tex_normal);
-		bgfx::setTexture(4, s_ao, tex_ao);
-		bgfx::setTexture(5, s_height, tex_height);
-		bgfx::setTexture(6, s_skybox_irr, tex_skybox_irr);
-		bgfx::setTexture(7, s_skybox_prefilter, tex_skybox_prefilter);
-		bgfx::setTexture(8, s_brdf_lut, tex_brdf_lut);
+		bgfx::setUniform(u_sh, sh_irradiance.data(), 9);
+
+		bgfx::setTexture(0, s_albedo, io::streamer().handle(material.albedo));
+		bgfx::setTexture(1, s_orm, io::streamer().handle(material.orm));
+		bgfx::setTexture(2, s_normal, io::streamer().handle(material.normal));
+		bgfx::setTexture(3, s_skybox_prefilter, prefilter);
+		bgfx::setTexture(4, s_brdf_lut, tex_brdf_lut);
 		bgfx::setVertexBuffer(0, sphere_vb);
 		bgfx::setIndexBuffer(sphere_ib);
 		bgfx::setState(opaque_state);
-		bgfx::submit(opaque_id, pbr_prog);
+		bgfx::submit(view_id, io::programs().handle(pbr_prog));
+	}
 
-		// skybox has to be in a separate drawcall since uniform changed
- 		view = glm::mat4(glm::mat3(view));
-		bgfx::setViewTransform(skybox_id, &view[0][0], &proj[0][0]);
-		bgfx::setViewRect(skybox_id, 0, 0, uint16_t(getWidth()), uint16_t(getHeight()));
-		// bgfx::setTexture(0, s_skybox, tex_skybox);
-		// bgfx::setTexture(0, s_skybox, tex_skybox_irr);
-		bgfx::setTexture(0, s_skybox, tex_skybox);
-		bgfx::setVertexBuffer(0, skybox_vb);
-		bgfx::setState(skybox_state);
-		bgfx::submit(skybox_id, skybox_prog);
+	// an equirectangular .hdr/.exr, a folder of skybox faces, or any of its faces
+	void onDrop(int count, const char** paths) {
+		if (count < 1 || env_loading.valid()) {
+			return;
+		}
+		std::string dir = paths[0];
+		if (has_extension(dir, ".hdr") || has_extension(dir, ".exr")) {
+			env_loading = std::async(std::launch::async, load_environment_equirect, dir);
+			return;
+		}
+		struct stat st;
+		if (stat(dir.c_str(), &st) != 0) {
+			return;
+		}
+		if (!S_ISDIR(st.st_mode)) {
+			dir = dir.substr(0, dir.find_last_of('/'));
+		}
+		env_loading = std::async(std::launch::async, load_environment, dir);
+	}
 
-		// do not call bgfx::frame() here. Or imgui would flash
-		// bgfx::frame();
+	void update_environment() {
+		if (env_loading.valid() && env_loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+			Environment env = env_loading.get();
+			if (env.ok && env.equirect) {
+				// a quarter of the width, rounded down to a power of two
+				int res = 1;
+				while (res * 2 <= int(env.equirect->m_width) / 4) {
+					res *= 2;
+				}
+				env_sh = env.sh;
+				env_baker->start_equirect(io::create_texture_equirect(env.equirect), res, 256, 5);
+			} else if (env.ok) {
+				int res = int(env.faces[0]->m_width);
+				env_sh = env.sh;
+				env_baker->start(io::create_texture_cube(env.faces), res, 256, 5);
+			} else {
+				std::cout << "Cannot load the dropped environment" << std::endl;
+			}
+		}
+
+		if (env_baker->update()) {
+			if (bgfx::isValid(tex_skybox)) {
+				bgfx::destroy(tex_skybox);
+			} else {
+				io::streamer().remove(skybox_stream);
+			}
+			bgfx::destroy(tex_skybox_prefilter);
+			env_baker->take(tex_skybox, tex_skybox_prefilter);
+			sh_irradiance = env_sh;
+		}
 	}
 public:
 	PbrApp() : app::Application("PBR") {}
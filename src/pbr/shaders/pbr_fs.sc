@@ -13,15 +13,13 @@ uniform vec4 u_metallic_roughness_ao_scale;
 
 uniform mat4 u_view_inv;
 
+uniform vec4 u_sh[9]; // irradiance, in world space. See pcp::SH9
+
 SAMPLER2D(s_albedo, 0);
-SAMPLER2D(s_roughness, 1);
-SAMPLER2D(s_metallic, 2);
-SAMPLER2D(s_normal, 3);
-SAMPLER2D(s_ao, 4);
-SAMPLER2D(s_height, 5);
-SAMPLERCUBE(s_skybox_irr, 6);
-SAMPLERCUBE(s_skybox_prefilter, 7);
-SAMPLER2D(s_brdf_lut, 8);
+SAMPLER2D(s_orm, 1); // r: ao, g: roughness, b: metallic, a: height. See io::pack_orm
+SAMPLER2D(s_normal, 2);
+SAMPLERCUBE(s_skybox_prefilter, 3);
+SAMPLER2D(s_brdf_lut, 4);
 
 float DistributionGGX(vec3 n, vec3 h, float roughness);
 float GeometrySchlickGGX(float n_v, float roughness);
@@ -33,8 +31,11 @@ vec3 compute_normal();
 vec3 compute_normal(vec3 norm, vec3 tangent, vec2 coord) {
     vec3 bitangent = cross(norm, tangent);
 
-    // tangent, bitangent, normal coordinates
-    vec3 tbn = vec3(texture2D(s_normal, coord)) * 2.0 - 1.0;
+    // tangent, bitangent, normal coordinates.
+    // z is rebuilt from x and y, BC5 normal maps only store those two
+    vec3 tbn;
+    tbn.xy = texture2D(s_normal, coord).rg * 2.0 - 1.0;
+    tbn.z = sqrt(clamp(1.0 - dot(tbn.xy, tbn.xy), 0.0, 1.0));
     return normalize(tangent * tbn.x + bitangent * tbn.y + norm * tbn.z);
 }
 
@@ -43,6 +44,20 @@ vec3 view2world(vec3 v){
     return vec3(u_view_inv * vec4(v, 0.0f));
 }
 
+// coefficients come pre-convolved and pre-scaled, only the polynomials are left
+vec3 sh9_irradiance(vec3 n) {
+    vec3 irradiance = u_sh[0].xyz
+        + u_sh[1].xyz * n.y
+        + u_sh[2].xyz * n.z
+        + u_sh[3].xyz * n.x
+        + u_sh[4].xyz * (n.x * n.y)
+        + u_sh[5].xyz * (n.y * n.z)
+        + u_sh[6].xyz * (3.0 * n.z * n.z - 1.0)
+        + u_sh[7].xyz * (n.x * n.z)
+        + u_sh[8].xyz * (n.x * n.x - n.y * n.y);
+    return max(irradiance, vec3(0.0f));
+}
+
 vec2 parallax_mapping(vec3 v, vec3 tangent, vec3 norm, vec2 coord) {
     vec3 bitangent = cross(norm, tangent);
     mat3 tbn = mat3(tangent, bitangent, norm);
@@ -53,11 +68,13 @@ vec2 parallax_mapping(vec3 v, vec3 tangent, vec3 norm, vec2 coord) {
     const int step_count = 10;
     vec3 step = -(v_tbn * vec3(height_scale / v_tbn.z)) / float(step_count);
     vec2 uv_result = vec2(0.0f);
+    // one fetch per step, the next height becomes the current one
+    float h_next = texture2D(s_orm, coord).a * height_scale;
     for (int i = 0; i < step_count; ++i) {
         vec3 cur = vec3(coord, height_scale) + float(i) * step;
         vec3 next = cur + step;
-        float h_cur = texture2D(s_height, cur.xy).r * height_scale;
-        float h_next = texture2D(s_height, next.xy).r * height_scale;
+        float h_cur = h_next;
+        h_next = texture2D(s_orm, next.xy).a * height_scale;
         if (h_cur < cur.z &&
             h_next > next.z) {
             float ratio = (cur.z - h_cur) / (h_next - next.z);
@@ -83,9 +100,10 @@ void main() {
     vec2 h_coord = parallax_mapping(v, v_tangent, v_frag_norm, v_texcoord0);
 
     vec3 albedo = pow(vec3(texture2D(s_albedo, h_coord)), vec3(2.2f));
-    float roughness = texture2D(s_roughness, h_coord).r;
-    float metallic = texture2D(s_metallic, h_coord).r;
-    float ao = texture2D(s_ao, h_coord).r;
+    vec4 orm = texture2D(s_orm, h_coord);
+    float ao = orm.r;
+    float roughness = orm.g;
+    float metallic = orm.b;
     vec3 n = compute_normal(v_frag_norm, v_tangent, h_coord);
     vec3 r = reflect(-v, n);
 
@@ -136,7 +154,7 @@ void main() {
     vec3 kd = 1.0 - ks;
     kd *= 1.0 - metallic;	  
     
-    vec3 irradiance = textureCube(s_skybox_irr, view2world(n)).rgb;
+    vec3 irradiance = sh9_irradiance(view2world(n));
     vec3 diffuse      = irradiance * albedo;
     
     // sample both the pre-filter map and the BRDF lut and combine them together as per the Split-Sum approximation to get the IBL specular part.
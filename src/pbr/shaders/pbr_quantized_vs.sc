@@ -0,0 +1,35 @@
+$input a_position    // half floats, w = 1
+$input a_normal      // octahedral in xy, see ProceduralShapes::QuantizedVertex
+$input a_texcoord0   // fixed point, 12 fractional bits
+$input a_tangent     // octahedral in xy
+
+$output v_frag_pos   // in view space
+$output v_frag_norm  // in view space
+$output v_texcoord0
+$output v_tangent    // in view space
+
+#include <bgfx_shader.sh>
+
+uniform mat4 u_model_inv_t;
+
+// the attributes keep their types from varying.def.sc, the components missing from the vertices read as 0
+vec3 oct_decode(vec2 e) {
+    vec3 n = vec3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    // unfold the lower half
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main() {
+    vec3 normal = oct_decode(a_normal.xy);
+    vec3 tangent = oct_decode(a_tangent.xy);
+
+    v_frag_pos = vec3(u_modelView * vec4(a_position, 1.0f));
+    v_frag_norm = vec3(u_view * u_model_inv_t * vec4(normal, 0.0f));
+    v_texcoord0 = a_texcoord0 * (1.0f / 4096.0f);
+    v_tangent = vec3(u_modelView * vec4(tangent, 0.0f));
+
+    gl_Position = u_modelViewProj * vec4(a_position, 1.0);
+}
@@ -14,7 +14,7 @@ class ScreenQuadApp : public app::Application {
     };
 
     bgfx::VertexBufferHandle vb_hdl = BGFX_INVALID_HANDLE;
-    bgfx::ProgramHandle prog = BGFX_INVALID_HANDLE;
+    io::ProgramId prog;
 
     void initialize(int argc, char** argv) {
         bgfx::VertexLayout layout;
@@ -22,11 +22,10 @@ class ScreenQuadApp : public app::Application {
             .add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
         .end();
         vb_hdl = bgfx::createVertexBuffer(bgfx::makeRef(vb.data(), vb.size() * sizeof(float)), layout);
-        prog = io::load_program("shaders/glsl/screen_quad_vs.bin", "shaders/glsl/screen_quad_fs.bin");
+        prog = io::programs().load("shaders/glsl/screen_quad_vs.bin", "shaders/glsl/screen_quad_fs.bin");
     }
 
     int shutdown() {
-        bgfx::destroy(prog);
         bgfx::destroy(vb_hdl);
 
         return 0;
@@ -39,7 +38,7 @@ class ScreenQuadApp : public app::Application {
                         BGFX_STATE_WRITE_A | 
                         BGFX_STATE_DEPTH_TEST_ALWAYS);
         bgfx::setVertexBuffer(0, vb_hdl);
-        bgfx::submit(0, prog);
+        bgfx::submit(0, io::programs().handle(prog));
     }
 
 public: